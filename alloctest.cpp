@@ -0,0 +1,94 @@
+#include "spectrumpainter.hpp"
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+
+using namespace std;
+
+// Checks that SpectrumPainter::feedWithInput makes no heap allocations once
+// it is running, whatever the chunk size. Every operator new of the process
+// is counted, so the painter runs on this thread only. Exits with 1 if the
+// count grows while feeding.
+
+static atomic<long> allocations(0);
+
+void* operator new(size_t size)
+{
+	++allocations;
+	void *p = malloc(size ? size : 1);
+	if(!p) throw bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+// Chunk sizes from single samples to several batches at once
+static const int chunkSizes[] = {1, 37, 200, 441, 1764, 4096, 8192, 100000};
+static const int chunkCount = sizeof(chunkSizes) / sizeof(chunkSizes[0]);
+
+static void feed(SpectrumPainter &painter, const vector<float> &input, long begin, long end)
+{
+	for(long i = begin, chunk = 0; i < end; ++chunk)
+	{
+		int count = int(min(long(chunkSizes[chunk % chunkCount]), end - i));
+		painter.feedWithInput(&input[i], count);
+		i += count;
+	}
+}
+
+// The painter warms up on the first seconds, then no allocation may happen
+static bool check(const char *name, Settings settings, int width, const vector<float> &input)
+{
+	SDL_Surface *image = SpectrumPainter::createSurface(width, SpectrumPainter::getImageHeight(settings), settings);
+	SpectrumPainter painter(image, settings);
+
+	long warmUp = 3L * settings.sampleRate;
+	feed(painter, input, 0, warmUp);
+	long before = allocations;
+	feed(painter, input, warmUp, input.size());
+	long made = allocations - before;
+
+	printf("%-28s %ld allocations\n", name, made);
+	SDL_FreeSurface(image);
+	return made == 0;
+}
+
+int main(int argc, char **argv)
+{
+	Settings settings;
+	vector<float> input(20L * settings.sampleRate);
+	srand(1);
+	for(long i = 0; i < input.size(); ++i)
+		input[i] = 8000.0f * sinf(i * 0.05f) + float(rand() % 2000 - 1000);
+
+	bool passed = true;
+	settings.wrapAround = true;
+	passed &= check("wrap around, 32 bpp", settings, 800, input);
+	settings.bitsPerPixel = 24;
+	passed &= check("wrap around, 24 bpp", settings, 800, input);
+	settings.wrapAround = false;
+	passed &= check("scrolling, 24 bpp", settings, 800, input);
+	settings.bitsPerPixel = 32;
+	passed &= check("scrolling, 32 bpp", settings, 800, input);
+	settings.fftSize = 512;
+	settings.windowInc = 64;
+	settings.computeHelper();
+	passed &= check("scrolling, fft 512", settings, 800, input);
+
+	if(!passed) {
+		printf("feedWithInput allocates on the heap\n");
+		return 1;
+	}
+	printf("No heap allocations while feeding\n");
+	return 0;
+}
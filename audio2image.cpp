@@ -1,11 +1,25 @@
 #include "spectrumpainter.hpp"
+#include "audioreader.hpp"
+#include "parallelpainter.hpp"
+#include "pyramid.hpp"
+#include "batch.hpp"
 #include <sndfile.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
 
 using namespace std;
 
 void showHelp(const Settings &settings)
 {
-	printf("Syntax: audio2image inputfile outputfile [fftsize] [windowinc] [tradeoff] [upperfreq] [labels]\n");
+	printf("Syntax: audio2image [options] inputfile outputfile [fftsize] [windowinc] [tradeoff] [upperfreq] [labels]\n");
+	printf("        audio2image [options] -batch listfile [fftsize] [windowinc] [tradeoff] [upperfreq] [labels]\n");
+	printf("        audio2image [options] -batchdir inputdir outputdir [fftsize] [windowinc] [tradeoff] [upperfreq] [labels]\n");
 	printf("\tfftsize    = FFT window size (default %d)\n", settings.fftSize);
 	printf("\twindowinc = FFT window movement (default %d)\n", settings.windowInc);
 	printf("\ttradeoff  = frequency/time-resolution-tradeoff (default %f)\n", settings.tradeoff);
@@ -13,46 +27,351 @@ void showHelp(const Settings &settings)
 	printf("\t\t(10 for high resolution in time domain)\n");
 	printf("\tupperfreq = maximal frequency in image (default %f)\n", settings.upperFreqLimit);
 	printf("\tlabels = 1 with labels, 0 without labels (default 1)\n", settings.labels);
+	printf("Options:\n");
+	printf("\t-chunk frames = frames per read from the input file (default 65536)\n");
+	printf("\t-float        = read float instead of 16 bit samples\n");
+	printf("\t-threads n    = number of worker threads (default %d)\n", settings.threads);
+	printf("\t-fftkernel k  = FFT kernel: avx512, avx2, sse2 or scalar (default %s)\n", FFTKernel::best()->name);
+	printf("\t-colormap c   = color map: %s (default %s)\n", Colormap::getNames().c_str(), settings.colormap->getName());
+	printf("\t-bpp n        = bits per pixel of the image, 24 or 32 (default %d)\n", settings.bitsPerPixel);
+	printf("\t-tiles n      = write tiles of n columns and a JSON manifest instead of one image\n");
+	printf("\t-pyramid n    = write a DeepZoom pyramid of n x n tiles (n even) instead of one image\n");
+	printf("\t-pooling p    = max or mean of 2x2 pixels for the smaller pyramid levels (default max)\n");
+	printf("\t-spectrum f   = also write the magnitude spectra to the raw float32 file f\n");
+	printf("\t-half         = write the spectra as float16\n");
+	printf("\t-cache dir    = keep the spectra of every input in dir and reuse them for the same\n");
+	printf("\t                file, fftsize, windowinc and tradeoff, so only the colors are computed\n");
+	printf("Batch mode:\n");
+	printf("\t-batch f      = render the files listed in f, one \"input output\" pair per line\n");
+	printf("\t-batchdir i o = render every audio file in directory i to a PNG in directory o\n");
+	printf("\t-report f     = write one JSON line per file to f (default stdout)\n");
+	printf("\t                -threads is the number of files rendered at the same time\n");
 }
 
-int main(int argc, char **argv)
+static const Uint64 FNV_OFFSET = 14695981039346656037ULL;
+
+static Uint64 hashBytes(const unsigned char *data, size_t count, Uint64 hash = FNV_OFFSET)
+{
+	for(size_t i = 0; i < count; ++i)
+		hash = (hash ^ data[i]) * 1099511628211ULL;
+	return hash;
+}
+
+// FNV-1a hash of the file contents, 0 if it cannot be read
+Uint64 hashFile(const char *filename)
+{
+	Uint64 hash = FNV_OFFSET;
+	FILE *file = fopen(filename, "rb");
+	if(!file) return 0;
+
+	vector<unsigned char> buffer(1 << 20);
+	size_t count;
+	while((count = fread(&buffer[0], 1, buffer.size(), file)) > 0)
+		hash = hashBytes(&buffer[0], count, hash);
+	fclose(file);
+	return hash;
+}
+
+// Hashing reads the whole input, so the hash is kept in the cache
+// directory under the path of the input, together with its size and
+// modification time. The file is only read again when one of them changed.
+Uint64 cachedHashFile(const string &directory, const char *inputfile)
+{
+	struct stat info;
+	char *path = realpath(inputfile, NULL);
+	if(!path || stat(path, &info) != 0) {
+		free(path);
+		return hashFile(inputfile);
+	}
+
+	stringstream keyName;
+	keyName << directory << "/" << hex << setfill('0') << setw(16)
+		<< hashBytes(reinterpret_cast<unsigned char*>(path), strlen(path)) << ".key";
+	free(path);
+
+	ifstream keyFile(keyName.str().c_str());
+	long size, seconds, nanoseconds;
+	Uint64 hash;
+	if(keyFile >> size >> seconds >> nanoseconds >> hex >> hash && size == info.st_size &&
+		seconds == info.st_mtim.tv_sec && nanoseconds == info.st_mtim.tv_nsec)
+		return hash;
+
+	hash = hashFile(inputfile);
+	ofstream key(keyName.str().c_str());
+	key << info.st_size << " " << info.st_mtim.tv_sec << " " << info.st_mtim.tv_nsec << " " << hex << hash << endl;
+	return hash;
+}
+
+// Everything the spectra depend on is part of the name. Samples read as
+// float keep more than 16 bits, and the vector kernels round differently.
+string cacheFilename(const string &directory, const char *inputfile, const Settings &settings, bool floatSamples)
+{
+	stringstream name;
+	name << directory << "/" << hex << setfill('0') << setw(16) << cachedHashFile(directory, inputfile) << dec
+		<< "-" << settings.fftSize << "-" << settings.windowInc << "-" << settings.tradeoff
+		<< (floatSamples ? "-f32" : "-s16") << "-" << settings.fftKernel->name << ".spec";
+	return name.str();
+}
+
+// Number of columns the FFT produces, the image has at least one
+long columnsComputed(long frames, const Settings &settings)
+{
+	return frames >= settings.fftSize ? SpectrumPainter::getImageWidth(frames, settings) : 0;
+}
+
+// Feeds the file chunk by chunk straight into the painter, so memory usage
+// depends on the FFT and image size only, not on the file length. With
+// cached spectra, the file is not read at all.
+SDL_Surface* streamToImage(AudioReader &reader, long frames, const Settings &settings, const SpectrumFile *cache)
+{
+	SDL_Surface *image = SpectrumPainter::createImage(frames, settings);
+
+	SDL_LockSurface(image);
+
+	ParallelPainter spectrumPainter(image, settings);
+	vector<float> input;
+	long nextProgress = 0;
+
+	if(cache)
+		spectrumPainter.feedWithMagnitudes(cache->getColumn(0), columnsComputed(frames, settings));
+
+	while(!cache && reader.readMono(input) > 0)
+	{
+		for(; nextProgress < reader.getFramesRead(); nextProgress += settings.sampleRate)
+			cout << nextProgress / settings.sampleRate << " ";
+		cout.flush();
+		spectrumPainter.feedWithInput(input);
+	}
+	spectrumPainter.flush();
+
+	cout << "Complete!" << endl;
+
+	SDL_UnlockSurface(image);
+	if(settings.labels) spectrumPainter.drawLabeling(image);
+
+	return image;
+}
+
+// Renders the image as tiles of tileWidth columns, named after the output
+// file with the tile number appended. Every tile is saved and freed as soon
+// as it is complete, so memory usage does not depend on the file length.
+// The manifest next to the tiles describes the whole image. With pyramid
+// set, the tiles go into the pyramid instead. With cached spectra, the
+// file is not read at all.
+void streamToTiles(AudioReader &reader, long frames, const Settings &settings, const SpectrumFile *cache,
+	int tileWidth, const string &output, bool pyramid = false, bool maxPooling = true)
+{
+	long imageWidth = SpectrumPainter::getImageWidth(frames, settings);
+	int imageHeight = SpectrumPainter::getImageHeight(settings);
+	long tileCount = (imageWidth + tileWidth - 1) / tileWidth;
+
+	cout << "Frames: " << frames << endl;
+	cout << "Length: " << float(frames) / settings.sampleRate << " sec" << endl;
+	cout << "Compute " << tileCount << " tiles of size " << tileWidth << "x" << imageHeight
+		<< " for an image of size " << imageWidth << "x" << imageHeight << ":" << endl;
+
+	string base = output;
+	if(base.size() > 4 && base.substr(base.size() - 4) == ".png")
+		base.erase(base.size() - 4);
+	vector<string> tileNames;
+	PyramidWriter *pyramidWriter = NULL;
+	if(pyramid) pyramidWriter = new PyramidWriter(base, imageWidth, imageHeight, tileWidth, maxPooling, settings);
+
+	// The pyramid is made from the palette indices of every tile
+	Settings tileSettings = settings;
+	vector<Uint16> indices;
+	if(pyramid) {
+		indices.resize(long(tileWidth) * imageHeight);
+		tileSettings.indices = &indices[0];
+	}
+
+	// Samples from the first one of the current tile on
+	vector<float> buffer, input;
+	// One painter for all tiles, its workers keep running from tile to tile
+	ParallelPainter *spectrumPainter = NULL;
+
+	for(long tile = 0; tile < tileCount; ++tile)
+	{
+		int columns = int(min(long(tileWidth), imageWidth - tile * tileWidth));
+		long needed = long(columns - 1) * settings.windowInc + settings.fftSize;
+		while(!cache && buffer.size() < needed && reader.readMono(input) > 0)
+			buffer.insert(buffer.end(), input.begin(), input.end());
+		if(!cache && buffer.size() < needed) buffer.resize(needed, 0.0f);
+
+		SDL_Surface *image = SpectrumPainter::createSurface(columns, imageHeight, settings);
+		SDL_LockSurface(image);
+		if(spectrumPainter)
+			spectrumPainter->setSurface(image);
+		else
+			spectrumPainter = new ParallelPainter(image, tileSettings);
+		spectrumPainter->setFirstColumn(tile * tileWidth);
+		if(cache)
+			spectrumPainter->feedWithMagnitudes(cache->getColumn(tile * tileWidth), columns);
+		else {
+			spectrumPainter->feedWithInput(&buffer[0], needed);
+			spectrumPainter->flush();
+		}
+		SDL_UnlockSurface(image);
+
+		if(pyramidWriter)
+			pyramidWriter->addStrip(&indices[0], columns);
+		else {
+			if(settings.labels) spectrumPainter->drawLabeling(image);
+			stringstream name;
+			name << base << "-" << setfill('0') << setw(6) << tile << ".png";
+			IMG_SavePNG(image, name.str().c_str());
+			tileNames.push_back(name.str());
+		}
+		SDL_FreeSurface(image);
+		cout << tile << " ";
+		cout.flush();
+
+		long consumed = min(long(tileWidth) * settings.windowInc, long(buffer.size()));
+		buffer.erase(buffer.begin(), buffer.begin() + consumed);
+	}
+	delete spectrumPainter;
+	cout << "Complete!" << endl;
+
+	if(pyramidWriter) {
+		pyramidWriter->finish();
+		cout << "Wrote " << pyramidWriter->getLevels() << " pyramid levels to " << base << ".dzi" << endl;
+		delete pyramidWriter;
+	}
+	else SpectrumPainter::writeTileManifest(base, tileNames, imageWidth, imageHeight, tileWidth, settings);
+}
+
+// SDL, SDL_image and SDL_ttf are initialized once for all files
+int runBatch(Settings &settings, const char *batchlist, const char *batchinput, const char *batchoutput,
+	const char *reportfile, int chunkFrames, bool floatSamples)
+{
+	vector<BatchJob> jobs;
+	if(batchlist)
+		BatchRunner::readList(batchlist, jobs);
+	else
+		BatchRunner::readDirectory(batchinput, batchoutput, jobs);
+
+	int result;
+	result = SDL_Init(SDL_INIT_VIDEO);
+	Error::raiseIfNotNull(result, "SDL_Init failed");
+	result = IMG_Init(IMG_INIT_PNG);
+	Error::raiseIfNull(result & IMG_INIT_PNG, "IMG_Init failed");
+	result = TTF_Init();
+	Error::raiseIfNotNull(result, "TTF_Init failed");
+
+	if(!settings.fftKernel) settings.fftKernel = FFTKernel::best();
+
+	ofstream reportStream;
+	if(reportfile) {
+		reportStream.open(reportfile);
+		Error::raiseIfNull(reportStream.is_open(), "Could not write the report");
+	}
+
+	BatchRunner runner(settings, "OpenSans-Regular.ttf", settings.threads, chunkFrames, floatSamples,
+		reportfile ? reportStream : cout);
+	Uint64 startTime = SDL_GetPerformanceCounter();
+	int failed = runner.run(jobs);
+	double renderTime = double(SDL_GetPerformanceCounter() - startTime) / SDL_GetPerformanceFrequency();
+
+	// The summary goes to stderr, stdout may be the report
+	cerr << "Rendered " << jobs.size() - failed << " of " << jobs.size() << " files in " << renderTime
+		<< " sec with " << settings.threads << " threads" << endl;
+	return failed > 0 ? 1 : 0;
+}
+
+int convert(int argc, char **argv)
 {
 	Settings settings;
+	settings.threads = SDL_GetCPUCount();
 	
-	char *inputfile, *outputfile;
-	if(argc < 3) {
+	int chunkFrames = 65536;
+	int tileWidth = 0;
+	bool pyramid = false, maxPooling = true;
+	char *spectrumfile = NULL, *cachedir = NULL;
+	char *batchlist = NULL, *batchinput = NULL, *batchoutput = NULL, *reportfile = NULL;
+	bool halfFloat = false;
+	bool floatSamples = false;
+	vector<char*> args;
+	for(int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if(arg == "-chunk" && i + 1 < argc) chunkFrames = atoi(argv[++i]);
+		else if(arg == "-float") floatSamples = true;
+		else if(arg == "-threads" && i + 1 < argc) settings.threads = atoi(argv[++i]);
+		else if(arg == "-fftkernel" && i + 1 < argc) {
+			settings.fftKernel = FFTKernel::find(argv[++i]);
+			if(!settings.fftKernel) {printf("Error: FFT kernel %s is not supported!\n", argv[i]); return 1;}
+		}
+		else if(arg == "-colormap" && i + 1 < argc) {
+			settings.colormap = Colormap::find(argv[++i]);
+			if(!settings.colormap) {printf("Error: unknown color map %s!\n", argv[i]); return 1;}
+		}
+		else if(arg == "-bpp" && i + 1 < argc) settings.bitsPerPixel = atoi(argv[++i]);
+		else if(arg == "-tiles" && i + 1 < argc) tileWidth = atoi(argv[++i]);
+		else if(arg == "-pyramid" && i + 1 < argc) {
+			tileWidth = atoi(argv[++i]);
+			pyramid = true;
+		}
+		else if(arg == "-spectrum" && i + 1 < argc) spectrumfile = argv[++i];
+		else if(arg == "-half") halfFloat = true;
+		else if(arg == "-cache" && i + 1 < argc) cachedir = argv[++i];
+		else if(arg == "-batch" && i + 1 < argc) batchlist = argv[++i];
+		else if(arg == "-batchdir" && i + 2 < argc) {
+			batchinput = argv[++i];
+			batchoutput = argv[++i];
+		}
+		else if(arg == "-report" && i + 1 < argc) reportfile = argv[++i];
+		else if(arg == "-pooling" && i + 1 < argc) {
+			string pooling = argv[++i];
+			if(pooling != "max" && pooling != "mean") {printf("Error: unknown pooling %s!\n", argv[i]); return 1;}
+			maxPooling = pooling == "max";
+		}
+		else args.push_back(argv[i]);
+	}
+
+	// In batch mode, the files are not among the arguments
+	bool batch = batchlist || batchinput;
+	int files = batch ? 0 : 2;
+	char *inputfile = NULL, *outputfile = NULL;
+	if(args.size() < files || (batchlist && batchinput)) {
 		showHelp(settings);
 		return 1;
 	}
 	
-	inputfile = argv[1];
-	outputfile = argv[2];
+	if(!batch) {
+		inputfile = args[0];
+		outputfile = args[1];
+	}
 	
-	if(argc >= 4) settings.fftSize = atoi(argv[3]);
-	if(argc >= 5) settings.windowInc = atoi(argv[4]);
-	if(argc >= 6) settings.tradeoff = atof(argv[5]);
-	if(argc >= 7) settings.upperFreqLimit = atoi(argv[6]);
-	if(argc >= 8) settings.labels = atoi(argv[7]);
+	if(args.size() >= files + 1) settings.fftSize = atoi(args[files]);
+	if(args.size() >= files + 2) settings.windowInc = atoi(args[files + 1]);
+	if(args.size() >= files + 3) settings.tradeoff = atof(args[files + 2]);
+	if(args.size() >= files + 4) settings.upperFreqLimit = atoi(args[files + 3]);
+	if(args.size() >= files + 5) settings.labels = atoi(args[files + 4]);
 
 	if(settings.fftSize <= 1 || settings.windowInc <= 0 ||
-		settings.upperFreqLimit <= 0 || settings.tradeoff < 1) {
+		settings.upperFreqLimit <= 0 || settings.tradeoff < 1 || chunkFrames <= 0 || settings.threads <= 0 || tileWidth < 0 || (pyramid && (tileWidth < 2 || tileWidth % 2 != 0)) ||
+		(settings.bitsPerPixel != 24 && settings.bitsPerPixel != 32)) {
 		printf("Error: parameters are invalid!\n"); return 1;}
 	
+	if(spectrumfile && cachedir) {
+		printf("Error: -spectrum and -cache cannot be combined, the cache files have the same format!\n"); return 1;}
+
 	if(settings.fftSize & (settings.fftSize - 1) != 0) {
 		printf("Error: windowsize must be power of 2!\n"); return 1;}
 
+	if(batch && (tileWidth > 0 || spectrumfile || cachedir)) {
+		printf("Error: -tiles, -pyramid, -spectrum and -cache are not supported in batch mode!\n"); return 1;}
+
+	if(batch)
+		return runBatch(settings, batchlist, batchinput, batchoutput, reportfile, chunkFrames, floatSamples);
+
 	SF_INFO sfinfo;
 	SNDFILE *sf = sf_open(inputfile, SFM_READ, &sfinfo);
-	if(sf == NULL) {printf("Error: Could not read file %s.\n", argv[1]); return 1;}
+	if(sf == NULL) {printf("Error: Could not read file %s.\n", inputfile); return 1;}
 
 	settings.sampleRate = sfinfo.samplerate;
 	settings.channels = sfinfo.channels;
 	settings.computeHelper();
 
-	vector<Sint16> audioData(sfinfo.frames * sfinfo.channels, 0.0);
-	for(int i = 0; i < sfinfo.frames; ++i)
-		sf_readf_short(sf, &audioData[i * sfinfo.channels], 1);
-
 	// Initialize SDL
 	int result;
 	result = SDL_Init(SDL_INIT_VIDEO);
@@ -68,9 +387,57 @@ int main(int argc, char **argv)
     settings.font = TTF_OpenFont("OpenSans-Regular.ttf", 16);
 	Error::raiseIfNull(settings.font, "TTF_OpenFont failed");
 
-	SDL_Surface *image = SpectrumPainter::audioToImage(audioData, settings);
-	IMG_SavePNG(image, outputfile);
-	SDL_FreeSurface(image);
+	if(!settings.fftKernel) settings.fftKernel = FFTKernel::best();
+	cout << "FFT kernel: " << settings.fftKernel->name << endl;
+
+	long imageWidth = SpectrumPainter::getImageWidth(sfinfo.frames, settings);
+	if(spectrumfile)
+		settings.spectrumFile = new SpectrumFile(spectrumfile, imageWidth, settings, halfFloat);
+
+	// A missing cache file is written under a temporary name first, so
+	// an interrupted run leaves no incomplete one behind
+	SpectrumFile *cache = NULL;
+	string cacheFile;
+	if(cachedir) {
+		mkdir(cachedir, 0755);
+		cacheFile = cacheFilename(cachedir, inputfile, settings, floatSamples);
+		cache = SpectrumFile::openExisting(cacheFile, imageWidth, settings);
+		if(cache)
+			cout << "Using cached spectra " << cacheFile << endl;
+		else
+			settings.spectrumFile = new SpectrumFile(cacheFile + ".tmp", imageWidth, settings);
+	}
+
+	AudioReader reader(sf, sfinfo, chunkFrames, floatSamples);
+	Uint64 startTime = SDL_GetPerformanceCounter();
+	SDL_Surface *image = NULL;
+	if(tileWidth > 0)
+		streamToTiles(reader, sfinfo.frames, settings, cache, tileWidth, outputfile, pyramid, maxPooling);
+	else
+		image = streamToImage(reader, sfinfo.frames, settings, cache);
+	double renderTime = double(SDL_GetPerformanceCounter() - startTime) / SDL_GetPerformanceFrequency();
+	reader.printStatistics();
+	cout << "Render time: " << renderTime << " sec at " << settings.bitsPerPixel << " bits per pixel" << endl;
+	sf_close(sf);
+	if(image) {
+		IMG_SavePNG(image, outputfile);
+		SDL_FreeSurface(image);
+	}
+	delete settings.spectrumFile;
+	if(cachedir && !cache)
+		rename((cacheFile + ".tmp").c_str(), cacheFile.c_str());
+	delete cache;
 
 	return 0;
 }
+
+int main(int argc, char **argv)
+{
+	try {
+		return convert(argc, argv);
+	}
+	catch(Error e) {
+		cout << "Error: " << e.getMessage() << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,73 @@
+#include "audioreader.hpp"
+#include "spectrumpainter.hpp"
+#include <iostream>
+#include <algorithm>
+
+AudioReader::AudioReader(SNDFILE *sf, const SF_INFO &info, int chunkFrames, bool floatSamples)
+{
+	this->sf = sf;
+	this->channels = info.channels;
+	this->frames = info.frames;
+	this->chunkFrames = chunkFrames;
+	this->floatSamples = floatSamples;
+	framesRead = 0;
+	readTime = 0.0;
+
+	if(floatSamples)
+		floatBuffer.resize(chunkFrames * channels);
+	else
+		shortBuffer.resize(chunkFrames * channels);
+}
+
+int AudioReader::readMono(vector<float> &output)
+{
+	int count = int(min(long(chunkFrames), frames - framesRead));
+	if(count <= 0) {
+		output.clear();
+		return 0;
+	}
+
+	Uint64 startTime = SDL_GetPerformanceCounter();
+	sf_count_t result;
+	if(floatSamples)
+		result = sf_readf_float(sf, &floatBuffer[0], count);
+	else
+		result = sf_readf_short(sf, &shortBuffer[0], count);
+	readTime += double(SDL_GetPerformanceCounter() - startTime) / SDL_GetPerformanceFrequency();
+	if(result < 0) result = 0;
+
+	// Frames which cannot be read are treated as silence
+	if(floatSamples)
+	{
+		fill(floatBuffer.begin() + result * channels, floatBuffer.begin() + count * channels, 0.0f);
+		output.resize(count);
+		for(int i = 0; i < count; ++i)
+		{
+			float monoSample = 0.0;
+			for(int j = 0; j < channels; ++j)
+				monoSample += floatBuffer[i * channels + j];
+			output[i] = monoSample / channels;
+		}
+	}
+	else
+	{
+		fill(shortBuffer.begin() + result * channels, shortBuffer.begin() + count * channels, 0);
+		SpectrumPainter::mixToMono(&shortBuffer[0], count, channels, output);
+	}
+
+	framesRead += count;
+	return count;
+}
+
+double AudioReader::getThroughput() const
+{
+	int sampleBytes = floatSamples ? sizeof(float) : sizeof(short);
+	if(readTime <= 0.0) return 0.0;
+	return framesRead * channels * sampleBytes / readTime / (1024.0 * 1024.0);
+}
+
+void AudioReader::printStatistics() const
+{
+	cout << "Read " << framesRead << " frames in " << readTime << " sec (";
+	cout << getThroughput() << " MB/s)" << endl;
+}
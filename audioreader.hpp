@@ -0,0 +1,34 @@
+#ifndef AUDIOREADER_HPP
+#define AUDIOREADER_HPP
+
+#include <sndfile.h>
+#include <vector>
+
+using namespace std;
+
+// Reads an audio file in large chunks and mixes them down to mono.
+// Samples are either read as 16 bit integers (bit exact with the old
+// per-frame reader) or as floats via sf_readf_float.
+class AudioReader
+{
+public:
+	AudioReader(SNDFILE *sf, const SF_INFO &info, int chunkFrames = 65536, bool floatSamples = false);
+	int readMono(vector<float> &output);
+
+	long getFramesRead() const {return framesRead;}
+	double getReadTime() const {return readTime;}
+	double getThroughput() const;
+	void printStatistics() const;
+
+private:
+	SNDFILE *sf;
+	int channels, chunkFrames;
+	long frames, framesRead;
+	bool floatSamples;
+	double readTime;
+
+	vector<short> shortBuffer;
+	vector<float> floatBuffer;
+};
+
+#endif
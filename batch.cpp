@@ -0,0 +1,211 @@
+#include "batch.hpp"
+#include "audioreader.hpp"
+#include <sndfile.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <cstdio>
+
+BatchRunner::BatchRunner(const Settings &settings, const string &fontFile, int workers, int chunkFrames,
+	bool floatSamples, ostream &report)
+	: report(report)
+{
+	this->settings = settings;
+	this->fontFile = fontFile;
+	this->workers = max(workers, 1);
+	this->chunkFrames = chunkFrames;
+	this->floatSamples = floatSamples;
+	jobs = NULL;
+}
+
+void BatchRunner::readList(const char *filename, vector<BatchJob> &jobs)
+{
+	ifstream list(filename);
+	Error::raiseIfNull(list.is_open(), "Could not read the batch list");
+
+	string line;
+	while(getline(list, line))
+	{
+		if(!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if(line.empty() || line[0] == '#') continue;
+
+		size_t split = line.find('\t');
+		if(split == string::npos) split = line.find(' ');
+		size_t next = line.find_first_not_of(" \t", split);
+		if(split == string::npos || next == string::npos)
+			throw Error("Every line of the batch list needs an input and an output file");
+
+		BatchJob job;
+		job.input = line.substr(0, split);
+		job.output = line.substr(next);
+		jobs.push_back(job);
+	}
+}
+
+void BatchRunner::readDirectory(const char *inputDirectory, const char *outputDirectory, vector<BatchJob> &jobs)
+{
+	static const char *extensions[] = {".wav", ".flac", ".ogg", ".oga", ".aif", ".aiff", ".au", ".snd", ".caf",
+		".w64", ".mp3", NULL};
+
+	DIR *directory = opendir(inputDirectory);
+	Error::raiseIfNull(directory, "Could not read the input directory");
+	mkdir(outputDirectory, 0755);
+
+	vector<string> names;
+	while(dirent *entry = readdir(directory))
+	{
+		string name = entry->d_name;
+		size_t dot = name.find_last_of('.');
+		if(dot == string::npos || dot == 0) continue;
+		string extension = name.substr(dot);
+		transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		for(int i = 0; extensions[i]; ++i)
+			if(extension == extensions[i]) names.push_back(name);
+	}
+	closedir(directory);
+
+	// Same order on every run, whatever order the file system has
+	sort(names.begin(), names.end());
+	for(long i = 0; i < names.size(); ++i)
+	{
+		BatchJob job;
+		job.input = string(inputDirectory) + "/" + names[i];
+		job.output = string(outputDirectory) + "/" + names[i].substr(0, names[i].find_last_of('.')) + ".png";
+		jobs.push_back(job);
+	}
+}
+
+// The fonts are opened before the workers start, FreeType may not open
+// faces from several threads at once. Afterwards every worker only
+// renders with its own font.
+int BatchRunner::run(const vector<BatchJob> &jobs)
+{
+	this->jobs = &jobs;
+	nextJob = 0;
+	failed = 0;
+
+	int count = int(min(long(workers), max(1L, long(jobs.size()))));
+	vector<TTF_Font*> fonts;
+	for(int i = 0; i < count; ++i)
+	{
+		TTF_Font *font = TTF_OpenFont(fontFile.c_str(), 16);
+		Error::raiseIfNull(font, "TTF_OpenFont failed");
+		fonts.push_back(font);
+	}
+
+	vector<thread> threads;
+	for(int i = 1; i < count; ++i)
+		threads.push_back(thread(&BatchRunner::work, this, fonts[i]));
+	work(fonts[0]);
+	for(long i = 0; i < threads.size(); ++i)
+		threads[i].join();
+
+	for(long i = 0; i < fonts.size(); ++i)
+		TTF_CloseFont(fonts[i]);
+	return failed;
+}
+
+void BatchRunner::work(TTF_Font *font)
+{
+	Settings settings = this->settings;
+	settings.threads = 1;
+	settings.font = font;
+
+	for(size_t i = nextJob++; i < jobs->size(); i = nextJob++)
+	{
+		const BatchJob &job = (*jobs)[i];
+		stringstream line;
+		line << "{\"input\": " << jsonString(job.input) << ", \"output\": " << jsonString(job.output);
+
+		Uint64 startTime = SDL_GetPerformanceCounter();
+		try {
+			render(job, settings, line);
+			line << ", \"status\": \"ok\"";
+		}
+		catch(Error &error) {
+			line << ", \"status\": \"error\", \"error\": " << jsonString(error.getMessage());
+			++failed;
+		}
+		catch(exception &error) {
+			line << ", \"status\": \"error\", \"error\": " << jsonString(error.what());
+			++failed;
+		}
+		double seconds = double(SDL_GetPerformanceCounter() - startTime) / SDL_GetPerformanceFrequency();
+		line << ", \"seconds\": " << seconds << "}";
+		writeReport(line.str());
+	}
+}
+
+// Like audio2image for a single file, but quiet and with the painter on
+// the calling thread
+void BatchRunner::render(const BatchJob &job, Settings settings, stringstream &line)
+{
+	SF_INFO sfinfo;
+	sfinfo.format = 0;
+	SNDFILE *sf = sf_open(job.input.c_str(), SFM_READ, &sfinfo);
+	Error::raiseIfNull(sf, "Could not read the input file");
+
+	SDL_Surface *image = NULL;
+	try {
+		settings.sampleRate = sfinfo.samplerate;
+		settings.channels = sfinfo.channels;
+		settings.computeHelper();
+
+		long imageWidth = SpectrumPainter::getImageWidth(sfinfo.frames, settings);
+		int imageHeight = SpectrumPainter::getImageHeight(settings);
+		line << ", \"frames\": " << sfinfo.frames << ", \"sampleRate\": " << sfinfo.samplerate
+			<< ", \"channels\": " << sfinfo.channels << ", \"width\": " << imageWidth << ", \"height\": " << imageHeight;
+
+		if(!SpectrumPainter::fitsSurface(imageWidth, imageHeight, settings))
+			throw Error("Image is too large for a single surface, use tiles");
+		image = SpectrumPainter::createSurface(int(imageWidth), imageHeight, settings);
+
+		SDL_LockSurface(image);
+		SpectrumPainter spectrumPainter(image, settings);
+		AudioReader reader(sf, sfinfo, chunkFrames, floatSamples);
+		vector<float> input;
+		while(reader.readMono(input) > 0)
+			spectrumPainter.feedWithInput(input);
+		SDL_UnlockSurface(image);
+		if(settings.labels) spectrumPainter.drawLabeling(image);
+
+		Error::raiseIfNotNull(IMG_SavePNG(image, job.output.c_str()), "IMG_SavePNG failed");
+	}
+	catch(...) {
+		SDL_FreeSurface(image);
+		sf_close(sf);
+		throw;
+	}
+	SDL_FreeSurface(image);
+	sf_close(sf);
+}
+
+// Whole lines only, so the report stays readable while the workers run
+void BatchRunner::writeReport(const string &line)
+{
+	lock_guard<mutex> lock(reportMutex);
+	report << line << endl;
+}
+
+string BatchRunner::jsonString(const string &text)
+{
+	string result = "\"";
+	for(long i = 0; i < text.size(); ++i)
+	{
+		unsigned char c = text[i];
+		if(c == '"' || c == '\\') {
+			result += '\\';
+			result += c;
+		}
+		else if(c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			result += escaped;
+		}
+		else result += c;
+	}
+	return result + "\"";
+}
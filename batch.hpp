@@ -0,0 +1,59 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "spectrumpainter.hpp"
+#include <ostream>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+using namespace std;
+
+struct BatchJob
+{
+	string input, output;
+};
+
+// Renders many files in one process. SDL, SDL_image and SDL_ttf are
+// initialized once by the caller, every worker opens the font once and
+// keeps it for all of its jobs, and the painters share their FFT plans and
+// window tables. The files are spread over the workers, each file is
+// painted by a single thread. After every file one JSON line is written
+// to the report.
+class BatchRunner
+{
+public:
+	BatchRunner(const Settings &settings, const string &fontFile, int workers, int chunkFrames, bool floatSamples,
+		ostream &report);
+
+	// Lines of "input<TAB>output", or separated by spaces if there is no tab.
+	// Empty lines and lines starting with # are skipped.
+	static void readList(const char *filename, vector<BatchJob> &jobs);
+	// Every audio file in inputDirectory becomes a PNG of the same name in outputDirectory
+	static void readDirectory(const char *inputDirectory, const char *outputDirectory, vector<BatchJob> &jobs);
+
+	// Returns the number of files which failed
+	int run(const vector<BatchJob> &jobs);
+
+private:
+	void work(TTF_Font *font);
+	void render(const BatchJob &job, Settings settings, stringstream &line);
+	void writeReport(const string &line);
+
+	static string jsonString(const string &text);
+
+	Settings settings;
+	string fontFile;
+	int workers, chunkFrames;
+	bool floatSamples;
+
+	const vector<BatchJob> *jobs;
+	atomic<size_t> nextJob;
+	atomic<int> failed;
+
+	ostream &report;
+	mutex reportMutex;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "spectrumpainter.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+// Compares painting into the 24 and 32 bit images Settings::bitsPerPixel
+// offers. Both formats get the same input twice: as stored magnitudes,
+// which leaves only the intensities and the pixel stores to be timed, and
+// as samples including the FFT. The images of both formats have to show
+// the same colors. Exits with 1 if they differ.
+
+static const int fftSizes[] = {1024, 4096, 16384, 0};
+
+// Columns of every image, the best of ROUNDS is taken
+static const int COLUMNS = 4096;
+static const int ROUNDS = 5;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Nanoseconds per column, feed paints the whole image once
+template<class Feed> double timePainting(SpectrumPainter &painter, Feed feed)
+{
+	double best = 1e30;
+	for(int i = 0; i < ROUNDS; ++i) {
+		painter.reset();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		feed();
+		best = min(best, secondsSince(start));
+	}
+	return best * 1e9 / COLUMNS;
+}
+
+static Uint32 getPixel(SDL_Surface *surface, int x, int y)
+{
+	const Uint8 *p = static_cast<Uint8*>(surface->pixels) + long(y) * surface->pitch + x * surface->format->BytesPerPixel;
+	if(surface->format->BytesPerPixel == 4)
+		return *reinterpret_cast<const Uint32*>(p);
+	return p[0] | p[1] << 8 | p[2] << 16;
+}
+
+static bool sameColors(SDL_Surface *a, SDL_Surface *b)
+{
+	for(int y = 0; y < a->h; ++y)
+		for(int x = 0; x < a->w; ++x) {
+			Uint8 ar, ag, ab, br, bg, bb;
+			SDL_GetRGB(getPixel(a, x, y), a->format, &ar, &ag, &ab);
+			SDL_GetRGB(getPixel(b, x, y), b->format, &br, &bg, &bb);
+			if(ar != br || ag != bg || ab != bb) return false;
+		}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int failures = 0;
+	srand(1);
+
+	printf("%6s %6s %12s %12s %8s %12s %12s %8s\n", "size", "rows", "paint 24", "paint 32", "32 vs 24",
+		"fft+paint 24", "fft+paint 32", "32 vs 24");
+	for(int k = 0; fftSizes[k]; ++k)
+	{
+		Settings settings;
+		settings.fftSize = fftSizes[k];
+		settings.computeHelper();
+		int height = SpectrumPainter::getImageHeight(settings);
+
+		vector<float> input(long(COLUMNS - 1) * settings.windowInc + settings.fftSize);
+		for(long i = 0; i < input.size(); ++i)
+			input[i] = 8000.0f * sinf(i * 0.05f) + float(rand() % 2000 - 1000);
+		// Spread over the whole color map
+		vector<float> magnitudes(long(COLUMNS) * (settings.fftSize / 2));
+		for(long i = 0; i < magnitudes.size(); ++i)
+			magnitudes[i] = expf(float(rand()) / RAND_MAX * -9.0f);
+
+		double paintTime[2], inputTime[2];
+		SDL_Surface *magnitudeImages[2], *inputImages[2];
+		for(int j = 0; j < 2; ++j)
+		{
+			settings.bitsPerPixel = j == 0 ? 24 : 32;
+			magnitudeImages[j] = SpectrumPainter::createSurface(COLUMNS, height, settings);
+			inputImages[j] = SpectrumPainter::createSurface(COLUMNS, height, settings);
+
+			SpectrumPainter magnitudePainter(magnitudeImages[j], settings);
+			paintTime[j] = timePainting(magnitudePainter,
+				[&]() {magnitudePainter.feedWithMagnitudes(&magnitudes[0], COLUMNS);});
+			SpectrumPainter inputPainter(inputImages[j], settings);
+			inputTime[j] = timePainting(inputPainter,
+				[&]() {inputPainter.feedWithInput(&input[0], input.size());});
+		}
+
+		bool passed = sameColors(magnitudeImages[0], magnitudeImages[1]) && sameColors(inputImages[0], inputImages[1]);
+		printf("%6d %6d %12.0f %12.0f %7.2fx %12.0f %12.0f %7.2fx%s\n", settings.fftSize, height,
+			paintTime[0], paintTime[1], paintTime[0] / paintTime[1],
+			inputTime[0], inputTime[1], inputTime[0] / inputTime[1], passed ? "" : "  FAILED");
+		if(!passed) ++failures;
+
+		for(int j = 0; j < 2; ++j) {
+			SDL_FreeSurface(magnitudeImages[j]);
+			SDL_FreeSurface(inputImages[j]);
+		}
+	}
+	printf("Times in ns per column\n");
+
+	if(failures > 0) {
+		printf("%d sizes differ between 24 and 32 bpp\n", failures);
+		return 1;
+	}
+	printf("24 and 32 bpp images have the same colors\n");
+	return 0;
+}
@@ -0,0 +1,106 @@
+#include "colormap.hpp"
+
+static const float defaultStops[][3] = {
+	{0.0, 0.0, 0.0},
+	{0.0, 0.0, 0.75},
+	{0.0, 0.75, 0.0},
+	{0.8, 0.8, 0.0},
+	{0.9, 0.2, 0.2},
+	{1.0, 1.0, 1.0}};
+
+static const float viridisStops[][3] = {
+	{0.267, 0.004, 0.329},
+	{0.282, 0.157, 0.471},
+	{0.243, 0.290, 0.537},
+	{0.192, 0.408, 0.557},
+	{0.149, 0.510, 0.557},
+	{0.122, 0.620, 0.537},
+	{0.208, 0.718, 0.475},
+	{0.427, 0.804, 0.349},
+	{0.706, 0.871, 0.173},
+	{0.992, 0.906, 0.145}};
+
+static const float magmaStops[][3] = {
+	{0.000, 0.000, 0.016},
+	{0.094, 0.059, 0.243},
+	{0.271, 0.063, 0.467},
+	{0.447, 0.122, 0.506},
+	{0.624, 0.184, 0.498},
+	{0.804, 0.251, 0.443},
+	{0.945, 0.376, 0.365},
+	{0.992, 0.584, 0.404},
+	{0.996, 0.788, 0.553},
+	{0.988, 0.992, 0.749}};
+
+static const float grayscaleStops[][3] = {
+	{0.0, 0.0, 0.0},
+	{1.0, 1.0, 1.0}};
+
+#define STOPS(x) x, sizeof(x) / sizeof(x[0])
+
+static const Colormap* colormaps()
+{
+	static const Colormap maps[] = {
+		Colormap("default", STOPS(defaultStops)),
+		Colormap("viridis", STOPS(viridisStops)),
+		Colormap("magma", STOPS(magmaStops)),
+		Colormap("grayscale", STOPS(grayscaleStops))};
+	return maps;
+}
+
+static const int colormapCount = 4;
+
+
+Colormap::Colormap(const char *name, const float stops[][3], int count)
+{
+	this->name = name;
+	table.resize(SIZE);
+	for(int i = 0; i < SIZE; ++i)
+	{
+		float x = float(i) / (SIZE - 1) * (count - 1);
+		int xi = int(x);
+		float xf = x - xi;
+		if(xi >= count - 1) {xi = count - 2; xf = 1.0;}
+
+		float rgb[3];
+		for(int c = 0; c < 3; ++c)
+		{
+			rgb[c] = stops[xi][c] * (1.0 - xf) + stops[xi + 1][c] * xf;
+			if(rgb[c] < 0.0f) rgb[c] = 0.0f;
+			if(rgb[c] > 1.0f) rgb[c] = 1.0f;
+		}
+		table[i].r = int(rgb[0] * 255);
+		table[i].g = int(rgb[1] * 255);
+		table[i].b = int(rgb[2] * 255);
+		table[i].a = 255;
+	}
+}
+
+const Colormap* Colormap::getDefault()
+{
+	return &colormaps()[0];
+}
+
+const Colormap* Colormap::find(const string &name)
+{
+	for(int i = 0; i < colormapCount; ++i)
+		if(name == colormaps()[i].name)
+			return &colormaps()[i];
+	return NULL;
+}
+
+string Colormap::getNames()
+{
+	string names;
+	for(int i = 0; i < colormapCount; ++i)
+		names += string(i ? ", " : "") + colormaps()[i].name;
+	return names;
+}
+
+// Converts the table into pixel values of the given surface format
+void Colormap::bake(const SDL_PixelFormat *format, vector<Uint32> &palette) const
+{
+	palette.resize(SIZE);
+	for(int i = 0; i < SIZE; ++i)
+		palette[i] = SDL_MapRGB(format, table[i].r, table[i].g, table[i].b);
+}
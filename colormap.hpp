@@ -0,0 +1,33 @@
+#ifndef COLORMAP_HPP
+#define COLORMAP_HPP
+
+#include <SDL_surface.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+// Maps spectrum intensities in [0, 1] to colors. Every map is defined by
+// equally spaced color stops and baked once into a lookup table of SIZE
+// entries, so mapping an intensity is a single table lookup.
+class Colormap
+{
+public:
+	enum {SIZE = 4096};
+
+	Colormap(const char *name, const float stops[][3], int count);
+
+	static const Colormap* getDefault();
+	static const Colormap* find(const string &name);
+	static string getNames();
+
+	const char* getName() const {return name;}
+	const SDL_Color& getColor(int index) const {return table[index];}
+	void bake(const SDL_PixelFormat *format, vector<Uint32> &palette) const;
+
+private:
+	const char *name;
+	vector<SDL_Color> table;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "fftplan.hpp"
+#include <math.h>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+
+// The butterflies are the ones of Ooura's fft4g_h_float.c with the
+// sin/cos computations replaced by table lookups.
+
+#ifndef M_PI_2
+#define M_PI_2      1.570796326794896619231321691639751442098584699687
+#endif
+#define WR5000      0.707106781186547524400844362104849039284835937688
+
+#define RDFT_LOOP_DIV 64
+
+#define FFT_SIMD_NAMESPACE scalar
+#include "fftstages.inc"
+#undef FFT_SIMD_NAMESPACE
+
+
+FFTPlan::FFTPlan(int n, const FFTKernel *kernel)
+{
+	this->n = n;
+	this->kernel = kernel ? kernel : FFTKernel::best();
+	if(n > 4) {
+		makeBitReversal();
+		makeTwiddles();
+	}
+}
+
+// The plans of all sizes and kernels used so far, each computed once
+shared_ptr<const FFTPlan> FFTPlan::shared(int n, const FFTKernel *kernel)
+{
+	static mutex plansMutex;
+	static map<pair<int, const FFTKernel*>, shared_ptr<const FFTPlan> > plans;
+
+	if(!kernel) kernel = FFTKernel::best();
+	lock_guard<mutex> lock(plansMutex);
+	shared_ptr<const FFTPlan> &plan = plans[make_pair(n, kernel)];
+	if(!plan) plan = make_shared<FFTPlan>(n, kernel);
+	return plan;
+}
+
+void FFTPlan::rdft(float *a) const
+{
+	float xi;
+	if (n > 4) {
+		scalar::Stages<float>::bitrv2(a, swaps.data(), swaps.size());
+		cftfsub(a);
+		scalar::Stages<float>::rftfsub(n, a, rftTable.data());
+	} else if (n == 4) {
+		cftfsub(a);
+	}
+	xi = a[0] - a[1];
+	a[0] += a[1];
+	a[1] = xi;
+}
+
+// Transforms count frames of n values stored one after another. Kernels
+// with an interleaved transform take groups of kernel->lanes frames at
+// once, every vector lane computes one frame and no butterfly needs a
+// shuffle. A group which is not full is padded, so every frame takes the
+// same path and the result does not depend on how frames are batched.
+void FFTPlan::rdftBatch(float *a, int count) const
+{
+	if (!kernel->rdftLanes || n < 16) {
+		for (int i = 0; i < count; ++i) {
+			rdft(a + long(i) * n);
+		}
+		return;
+	}
+
+	int lanes = kernel->lanes;
+	thread_local vector<float> scratch;
+	scratch.resize(long(n) * lanes + 16);
+	float *buffer = reinterpret_cast<float*>((reinterpret_cast<uintptr_t>(scratch.data()) + 63) & ~uintptr_t(63));
+
+	for (int i = 0; i < count; i += lanes) {
+		kernel->rdftLanes(n, a + long(i) * n, min(lanes, count - i), buffer,
+			swaps.data(), swaps.size(), cftTable.data(), rftTable.data());
+	}
+}
+
+
+// Records the element swaps of bitrv2 so that the permutation
+// can be replayed without recomputing the reversed indices.
+void FFTPlan::makeBitReversal()
+{
+	int j0, k0, j1, k1, l, m, i, j, k;
+
+	l = n >> 2;
+	m = 2;
+	while (m < l) {
+		l >>= 1;
+		m <<= 1;
+	}
+	if (m == l) {
+		j0 = 0;
+		for (k0 = 0; k0 < m; k0 += 2) {
+			k = k0;
+			for (j = j0; j < j0 + k0; j += 2) {
+				swaps.push_back(j);
+				swaps.push_back(k);
+				j1 = j + m;
+				k1 = k + 2 * m;
+				swaps.push_back(j1);
+				swaps.push_back(k1);
+				j1 += m;
+				k1 -= m;
+				swaps.push_back(j1);
+				swaps.push_back(k1);
+				j1 += m;
+				k1 += 2 * m;
+				swaps.push_back(j1);
+				swaps.push_back(k1);
+				for (i = n >> 1; i > (k ^= i); i >>= 1);
+			}
+			j1 = j0 + k0 + m;
+			k1 = j1 + m;
+			swaps.push_back(j1);
+			swaps.push_back(k1);
+			for (i = n >> 1; i > (j0 ^= i); i >>= 1);
+		}
+	} else {
+		j0 = 0;
+		for (k0 = 2; k0 < m; k0 += 2) {
+			for (i = n >> 1; i > (j0 ^= i); i >>= 1);
+			k = k0;
+			for (j = j0; j < j0 + k0; j += 2) {
+				swaps.push_back(j);
+				swaps.push_back(k);
+				j1 = j + m;
+				k1 = k + m;
+				swaps.push_back(j1);
+				swaps.push_back(k1);
+				for (i = n >> 1; i > (k ^= i); i >>= 1);
+			}
+		}
+	}
+}
+
+void FFTPlan::makeTwiddles()
+{
+	int i, i0, j, kj, kr, t;
+	float ew, ec, wn4r, w1r, w1i, wkr, wki, wdr, wdi, ss;
+	float wk1r, wk1i, wk2r, wk2i, wk3r, wk3i;
+
+	// cft1st and cftmdl step through the same bit reversed angles,
+	// group t of either uses entry t of the table.
+	wn4r = WR5000;
+	ew = M_PI_2 / n;
+	kr = 0;
+	cftTable.resize(max(n / 16, 1) * CFT_ENTRY);
+	for (t = 1; t < n / 16; t++) {
+		for (kj = n >> 2; kj > (kr ^= kj); kj >>= 1);
+		float *w = &cftTable[t * CFT_ENTRY];
+		wk1r = cos(ew * kr);
+		wk1i = sin(ew * kr);
+		wk2r = 1 - 2 * wk1i * wk1i;
+		wk2i = 2 * wk1i * wk1r;
+		wk3r = wk1r - 2 * wk2i * wk1i;
+		wk3i = 2 * wk2i * wk1r - wk1i;
+		w[WK1R] = wk1r;
+		w[WK1I] = wk1i;
+		w[WK2R] = wk2r;
+		w[WK2I] = wk2i;
+		w[WK3R] = wk3r;
+		w[WK3I] = wk3i;
+		float x0r = wn4r * (wk1r - wk1i);
+		wk1i = wn4r * (wk1r + wk1i);
+		wk1r = x0r;
+		w[WK1R_2] = wk1r;
+		w[WK1I_2] = wk1i;
+		w[WK3R_2] = wk1r - 2 * wk2r * wk1i;
+		w[WK3I_2] = 2 * wk2r * wk1r - wk1i;
+	}
+
+	// rftfsub uses a recurrence which is restarted every RDFT_LOOP_DIV
+	// steps, store the factors of every step plus the final ones.
+	ec = 2 * M_PI_2 / n;
+	wkr = 0;
+	wki = 0;
+	wdi = cos(ec);
+	wdr = sin(ec);
+	wdi *= wdr;
+	wdr *= wdr;
+	w1r = 1 - 2 * wdr;
+	w1i = 2 * wdi;
+	ss = 2 * w1i;
+	i = n >> 1;
+	for (;;) {
+		i0 = i - 4 * RDFT_LOOP_DIV;
+		if (i0 < 4) {
+			i0 = 4;
+		}
+		for (j = i - 4; j >= i0; j -= 4) {
+			rftTable.push_back(wdr);
+			rftTable.push_back(wdi);
+			wkr += ss * wdi;
+			wki += ss * (0.5 - wdr);
+			rftTable.push_back(wkr);
+			rftTable.push_back(wki);
+			wdr += ss * wki;
+			wdi += ss * (0.5 - wkr);
+		}
+		if (i0 == 4) {
+			break;
+		}
+		wkr = 0.5 * sin(ec * i0);
+		wki = 0.5 * cos(ec * i0);
+		wdr = 0.5 - (wkr * w1r - wki * w1i);
+		wdi = wkr * w1i + wki * w1r;
+		wkr = 0.5 - wkr;
+		i = i0;
+	}
+	rftTable.push_back(wdr);
+	rftTable.push_back(wdi);
+}
+
+
+// Runs the radix-4 stages on the kernel of the plan where it has them
+void FFTPlan::cftfsub(float *a) const
+{
+	int l = 2;
+	if (n > 8) {
+		scalar::Stages<float>::cft1st(n, a, cftTable.data());
+		l = 8;
+		while ((l << 2) < n) {
+			if (kernel->cftmdl && l >= kernel->minLength) {
+				kernel->cftmdl(n, l, a, cftTable.data());
+			} else {
+				scalar::Stages<float>::cftmdl(n, l, a, cftTable.data());
+			}
+			l <<= 2;
+		}
+	}
+	if (kernel->cftlast && l >= kernel->minLength) {
+		kernel->cftlast(n, l, a);
+	} else {
+		scalar::Stages<float>::cftlast(n, l, a);
+	}
+}
+
@@ -0,0 +1,60 @@
+#ifndef FFTPLAN_HPP
+#define FFTPLAN_HPP
+
+#include <vector>
+#include <cstddef>
+#include <memory>
+
+using namespace std;
+
+// Vectorized butterfly stages for FFTPlan, see fftsimd.cpp. The scalar
+// kernel has no functions, FFTPlan then runs its own C code.
+struct FFTKernel
+{
+	const char *name;
+	int minLength;
+	void (*cftmdl)(int n, int l, float *a, const float *table);
+	void (*cftlast)(int n, int l, float *a);
+	// Transforms up to lanes frames of n >= 16 values at once, interleaved
+	// in buffer (n * lanes floats aligned to 64 bytes) so that every vector
+	// lane computes one frame
+	int lanes;
+	void (*rdftLanes)(int n, float *frames, int count, float *buffer,
+		const int *swaps, int swapCount, const float *cftTable, const float *rftTable);
+
+	static const FFTKernel* best();
+	static const FFTKernel* find(const char *name);
+};
+
+// Real forward FFT of a fixed size, computing the same transform as
+// rdft(n, 1, a) from fft4g_h_float.c. The bit reversal permutation and all
+// twiddle factors are computed once in the constructor (like the ip/w work
+// arrays of fft4g.c) instead of calling sin/cos in every transform.
+// The radix-4 stages run on the best FFTKernel of the CPU unless a
+// kernel is passed explicitly. A plan is never changed after construction,
+// so one plan from shared() can be used by any number of threads.
+class FFTPlan
+{
+public:
+	FFTPlan(int n, const FFTKernel *kernel = NULL);
+	static shared_ptr<const FFTPlan> shared(int n, const FFTKernel *kernel = NULL);
+	void rdft(float *a) const;
+	void rdftBatch(float *a, int count) const;
+	int size() const {return n;}
+	const FFTKernel* getKernel() const {return kernel;}
+
+	// Twiddle factors stored per radix-4 butterfly group in cftTable
+	enum {WK1R, WK1I, WK2R, WK2I, WK3R, WK3I, WK1R_2, WK1I_2, WK3R_2, WK3I_2, CFT_ENTRY};
+private:
+	void makeBitReversal();
+	void makeTwiddles();
+
+	void cftfsub(float *a) const;
+
+	int n;
+	const FFTKernel *kernel;
+	vector<int> swaps;
+	vector<float> cftTable, rftTable;
+};
+
+#endif
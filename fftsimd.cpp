@@ -0,0 +1,140 @@
+#include "fftplan.hpp"
+#include <string.h>
+
+#define WR5000      0.707106781186547524400844362104849039284835937688
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#define FFT_SIMD_NAMESPACE sse2
+#include "fftstages.inc"
+#include "fftsimd.inc"
+#undef FFT_SIMD_NAMESPACE
+
+namespace sse2 {
+	static void cftmdl(int n, int l, float *a, const float *table)
+	{
+		Complex<v4sf>::cftmdl(n, l, a, table);
+	}
+
+	static void cftlast(int n, int l, float *a)
+	{
+		Complex<v4sf>::cftlast(n, l, a);
+	}
+
+	static void rdftLanes(int n, float *frames, int count, float *buffer,
+		const int *swaps, int swapCount, const float *cftTable, const float *rftTable)
+	{
+		rdftInterleaved(n, frames, count, reinterpret_cast<v4sf*>(buffer), swaps, swapCount, cftTable, rftTable);
+	}
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define FFT_SIMD_NAMESPACE avx2
+#include "fftstages.inc"
+#include "fftsimd.inc"
+#undef FFT_SIMD_NAMESPACE
+
+namespace avx2 {
+	static void cftmdl(int n, int l, float *a, const float *table)
+	{
+		Complex<v8sf>::cftmdl(n, l, a, table);
+	}
+
+	static void cftlast(int n, int l, float *a)
+	{
+		Complex<v8sf>::cftlast(n, l, a);
+	}
+
+	static void rdftLanes(int n, float *frames, int count, float *buffer,
+		const int *swaps, int swapCount, const float *cftTable, const float *rftTable)
+	{
+		rdftInterleaved(n, frames, count, reinterpret_cast<v8sf*>(buffer), swaps, swapCount, cftTable, rftTable);
+	}
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#define FFT_SIMD_NAMESPACE avx512
+#include "fftstages.inc"
+#include "fftsimd.inc"
+#undef FFT_SIMD_NAMESPACE
+
+namespace avx512 {
+	// Butterfly runs of 8 floats only fill half a register
+	static void cftmdl(int n, int l, float *a, const float *table)
+	{
+		if(l >= 16) Complex<v16sf>::cftmdl(n, l, a, table);
+		else Complex<v8sf>::cftmdl(n, l, a, table);
+	}
+
+	static void cftlast(int n, int l, float *a)
+	{
+		if(l >= 16) Complex<v16sf>::cftlast(n, l, a);
+		else Complex<v8sf>::cftlast(n, l, a);
+	}
+
+	static void rdftLanes(int n, float *frames, int count, float *buffer,
+		const int *swaps, int swapCount, const float *cftTable, const float *rftTable)
+	{
+		rdftInterleaved(n, frames, count, reinterpret_cast<v16sf*>(buffer), swaps, swapCount, cftTable, rftTable);
+	}
+}
+#pragma GCC pop_options
+
+static const FFTKernel kernels[] = {
+	{"avx512", 8, avx512::cftmdl, avx512::cftlast, 16, avx512::rdftLanes},
+	{"avx2", 8, avx2::cftmdl, avx2::cftlast, 8, avx2::rdftLanes},
+	{"sse2", 4, sse2::cftmdl, sse2::cftlast, 4, sse2::rdftLanes},
+	{"scalar", 0, NULL, NULL, 1, NULL}};
+
+static bool kernelSupported(const FFTKernel &kernel)
+{
+	__builtin_cpu_init();
+	if(!strcmp(kernel.name, "avx512")) return __builtin_cpu_supports("avx512f");
+	if(!strcmp(kernel.name, "avx2")) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	if(!strcmp(kernel.name, "sse2")) return __builtin_cpu_supports("sse2");
+	return true;
+}
+
+#else
+
+static const FFTKernel kernels[] = {
+	{"scalar", 0, NULL, NULL, 1, NULL}};
+
+static bool kernelSupported(const FFTKernel &kernel)
+{
+	return true;
+}
+
+#endif
+
+
+// Widest instruction set supported by the CPU, the kernels are sorted
+// from the widest to scalar
+static const FFTKernel* detectKernel()
+{
+	for(int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i)
+		if(kernelSupported(kernels[i])) return &kernels[i];
+	return &kernels[sizeof(kernels) / sizeof(kernels[0]) - 1];
+}
+
+// Detected once, the initialization of the static is thread safe, so
+// painters on several threads all get the same kernel
+const FFTKernel* FFTKernel::best()
+{
+	static const FFTKernel *kernel = detectKernel();
+	return kernel;
+}
+
+const FFTKernel* FFTKernel::find(const char *name)
+{
+	for(int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i)
+		if(!strcmp(kernels[i].name, name) && kernelSupported(kernels[i]))
+			return &kernels[i];
+	return NULL;
+}
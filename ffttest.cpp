@@ -0,0 +1,118 @@
+#include "fftplan.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+// Reference transform from fft4g_h_float.c
+void rdft(int n, int isgn, float *a);
+
+// Checks every FFTKernel the CPU supports against rdft of
+// fft4g_h_float.c and times the transforms of 256 to 65536 samples, one
+// frame at a time and in batches. The scalar kernel has to be bit exact,
+// the vector kernels reorder additions and may differ in the last bits.
+// Exits with 1 on a mismatch.
+
+static const char *kernelNames[] = {"scalar", "sse2", "avx2", "avx512", NULL};
+
+// Relative to the largest value of the reference
+static const float SCALAR_TOLERANCE = 0.0f;
+static const float VECTOR_TOLERANCE = 1e-6f;
+
+// Every size is transformed this many samples in total for the timings
+static const long TIMED_SAMPLES = 1L << 24;
+
+// Frames per rdftBatch call, not a multiple of the vector lanes so the
+// padding of the last group is checked as well
+static const int BATCH_FRAMES = 37;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Nanoseconds per frame, transform gets all frames of the input at once
+template<class Transform> double timeTransform(int frames, const vector<float> &input, Transform transform)
+{
+	vector<float> data(input);
+	long repeats = max(1L, TIMED_SAMPLES / long(input.size()));
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	// Transforming the output again would overflow after a few rounds,
+	// so every round starts from the input. The copy is timed for all alike.
+	for(long i = 0; i < repeats; ++i) {
+		copy(input.begin(), input.end(), data.begin());
+		transform(&data[0]);
+	}
+	return secondsSince(start) * 1e9 / repeats / frames;
+}
+
+// Largest difference relative to the largest value of the reference
+static float maxError(const vector<float> &result, const vector<float> &reference)
+{
+	float largest = 0.0f, error = 0.0f;
+	for(long i = 0; i < reference.size(); ++i)
+		largest = max(largest, fabsf(reference[i]));
+	for(long i = 0; i < reference.size(); ++i)
+		error = max(error, fabsf(result[i] - reference[i]) / largest);
+	return error;
+}
+
+int main(int argc, char **argv)
+{
+	int failures = 0;
+	srand(1);
+
+	printf("%-8s %6s %10s %10s %10s %10s %9s %9s\n", "kernel", "size", "error", "batch err",
+		"ns/frame", "batch", "vs fft4g", "batched");
+	for(int n = 256; n <= 65536; n *= 2)
+	{
+		vector<float> input(long(n) * BATCH_FRAMES);
+		for(long i = 0; i < input.size(); ++i)
+			input[i] = float(rand()) / RAND_MAX * 2.0f - 1.0f;
+		vector<float> frame(input.begin(), input.begin() + n);
+
+		vector<float> reference(input);
+		for(int i = 0; i < BATCH_FRAMES; ++i)
+			rdft(n, 1, &reference[long(i) * n]);
+		vector<float> frameReference(reference.begin(), reference.begin() + n);
+
+		double referenceTime = timeTransform(1, frame, [n](float *a) {rdft(n, 1, a);});
+		printf("%-8s %6d %10s %10s %10.0f %10s %9s %9s\n", "fft4g", n, "-", "-", referenceTime, "-", "-", "-");
+
+		for(int k = 0; kernelNames[k]; ++k)
+		{
+			const FFTKernel *kernel = FFTKernel::find(kernelNames[k]);
+			if(!kernel) {
+				if(n == 256) printf("%-8s not supported by this CPU, skipped\n", kernelNames[k]);
+				continue;
+			}
+
+			FFTPlan plan(n, kernel);
+			vector<float> result(frame);
+			plan.rdft(&result[0]);
+			float error = maxError(result, frameReference);
+
+			result = input;
+			plan.rdftBatch(&result[0], BATCH_FRAMES);
+			float batchError = maxError(result, reference);
+
+			double time = timeTransform(1, frame, [&plan](float *a) {plan.rdft(a);});
+			double batchTime = timeTransform(BATCH_FRAMES, input, [&plan](float *a) {plan.rdftBatch(a, BATCH_FRAMES);});
+			float tolerance = kernel->cftmdl ? VECTOR_TOLERANCE : SCALAR_TOLERANCE;
+			bool passed = error <= tolerance && batchError <= tolerance;
+			printf("%-8s %6d %10.3g %10.3g %10.0f %10.0f %8.2fx %8.2fx%s\n", kernel->name, n, error, batchError,
+				time, batchTime, referenceTime / time, time / batchTime, passed ? "" : "  FAILED");
+			if(!passed) ++failures;
+		}
+	}
+
+	if(failures > 0) {
+		printf("%d comparisons failed\n", failures);
+		return 1;
+	}
+	printf("All kernels match fft4g\n");
+	return 0;
+}
@@ -0,0 +1,54 @@
+#include "labelcache.hpp"
+#include "spectrumpainter.hpp"
+
+LabelCache::LabelCache(SDL_Renderer *renderer, int maxEntries)
+{
+	this->renderer = renderer;
+	this->maxEntries = maxEntries;
+}
+
+LabelCache::~LabelCache()
+{
+	clear();
+}
+
+void LabelCache::clear()
+{
+	for(map<pair<TTF_Font*, string>, Entry>::iterator i = entries.begin(); i != entries.end(); ++i) {
+		if(i->second.texture) SDL_DestroyTexture(i->second.texture);
+		SDL_FreeSurface(i->second.surface);
+	}
+	entries.clear();
+}
+
+LabelCache::Entry& LabelCache::getEntry(TTF_Font *font, const string &text)
+{
+	pair<TTF_Font*, string> key(font, text);
+	map<pair<TTF_Font*, string>, Entry>::iterator i = entries.find(key);
+	if(i != entries.end()) return i->second;
+
+	// Time labels keep changing, so the cache is started over when full
+	if(entries.size() >= maxEntries) clear();
+
+	SDL_Color textColor = { 255, 255, 255, 255 };
+	Entry entry;
+	entry.surface = TTF_RenderText_Blended(font, text.c_str(), textColor);
+	Error::raiseIfNull(entry.surface, "TTF_RenderText_Blended failed");
+	entry.texture = NULL;
+	return entries[key] = entry;
+}
+
+SDL_Surface* LabelCache::getSurface(TTF_Font *font, const string &text)
+{
+	return getEntry(font, text).surface;
+}
+
+SDL_Texture* LabelCache::getTexture(TTF_Font *font, const string &text)
+{
+	Entry &entry = getEntry(font, text);
+	if(!entry.texture) {
+		entry.texture = SDL_CreateTextureFromSurface(renderer, entry.surface);
+		Error::raiseIfNull(entry.texture, "SDL_CreateTextureFromSurface failed");
+	}
+	return entry.texture;
+}
@@ -0,0 +1,42 @@
+#ifndef LABELCACHE_HPP
+#define LABELCACHE_HPP
+
+#include <SDL_surface.h>
+#include <SDL_render.h>
+#include <SDL_ttf.h>
+#include <map>
+#include <string>
+
+using namespace std;
+
+// Rendered label texts keyed by font and text. The same labels are drawn
+// frame after frame, so once they are cached no font rendering is left.
+// With a renderer, textures of the labels are kept as well.
+class LabelCache
+{
+public:
+	LabelCache(SDL_Renderer *renderer = NULL, int maxEntries = 512);
+	~LabelCache();
+
+	SDL_Surface* getSurface(TTF_Font *font, const string &text);
+	SDL_Texture* getTexture(TTF_Font *font, const string &text);
+	void clear();
+
+private:
+	struct Entry
+	{
+		SDL_Surface *surface;
+		SDL_Texture *texture;
+	};
+
+	Entry& getEntry(TTF_Font *font, const string &text);
+
+	LabelCache(const LabelCache&);
+	LabelCache& operator=(const LabelCache&);
+
+	map<pair<TTF_Font*, string>, Entry> entries;
+	SDL_Renderer *renderer;
+	int maxEntries;
+};
+
+#endif
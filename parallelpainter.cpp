@@ -0,0 +1,170 @@
+#include "parallelpainter.hpp"
+
+ParallelPainter::ParallelPainter(SDL_Surface *imageSurface, const Settings &settings)
+{
+	this->settings = settings;
+	int threads = max(settings.threads, 1);
+	for(int i = 0; i < threads; ++i)
+		painters.push_back(new SpectrumPainter(imageSurface, settings));
+	pendingColumn = 0;
+	// Large batches keep the synchronization cost small compared to the FFTs
+	columnsPerBatch = threads * 256;
+	pending.reserve(columnsPerBatch * settings.windowInc + settings.fftSize);
+	batchInput.reserve(pending.capacity());
+
+	batchMagnitudes = NULL;
+	batchColumn = 0;
+	batchColumns = 0;
+	batchNumber = 0;
+	busyWorkers = 0;
+	stopping = false;
+	for(int i = 0; i < threads; ++i)
+		workers.push_back(thread(&ParallelPainter::work, this, i));
+}
+
+ParallelPainter::~ParallelPainter()
+{
+	waitForBatch();
+	{
+		lock_guard<mutex> lock(batchMutex);
+		stopping = true;
+	}
+	batchStarted.notify_all();
+	for(int i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	for(int i = 0; i < painters.size(); ++i)
+		delete painters[i];
+}
+
+void ParallelPainter::feedWithInput(const vector<float> &input)
+{
+	feedWithInput(input.data(), input.size());
+}
+
+void ParallelPainter::feedWithInput(const float *input, int count)
+{
+	pending.insert(pending.end(), input, input + count);
+	int available = 0;
+	if(pending.size() >= settings.fftSize)
+		available = (pending.size() - settings.fftSize) / settings.windowInc + 1;
+	if(available >= columnsPerBatch)
+		drawColumns(available);
+}
+
+// Draws everything which is left and waits until the image is complete
+void ParallelPainter::flush()
+{
+	if(pending.size() >= settings.fftSize)
+		drawColumns((pending.size() - settings.fftSize) / settings.windowInc + 1);
+	waitForBatch();
+}
+
+// Hands the samples of the next columns to the workers once the previous
+// batch is finished. The buffers are swapped, only the samples after the
+// first one of the next column are copied back.
+void ParallelPainter::drawColumns(int columns)
+{
+	waitForBatch();
+	batchInput.swap(pending);
+	pending.assign(batchInput.begin() + long(columns) * settings.windowInc, batchInput.end());
+	batchMagnitudes = NULL;
+	startBatch(pendingColumn, columns);
+	pendingColumn += columns;
+}
+
+// Draws columns of stored magnitudes, split between the workers like the
+// columns of drawColumns. The magnitudes belong to the caller, so this
+// returns only when they are drawn.
+void ParallelPainter::feedWithMagnitudes(const float *magnitudes, int columns)
+{
+	waitForBatch();
+	batchMagnitudes = magnitudes;
+	startBatch(pendingColumn, columns);
+	waitForBatch();
+	batchMagnitudes = NULL;
+	pendingColumn += columns;
+}
+
+void ParallelPainter::startBatch(long column, int columns)
+{
+	{
+		lock_guard<mutex> lock(batchMutex);
+		batchColumn = column;
+		batchColumns = columns;
+		busyWorkers = workers.size();
+		++batchNumber;
+	}
+	batchStarted.notify_all();
+}
+
+void ParallelPainter::waitForBatch()
+{
+	unique_lock<mutex> lock(batchMutex);
+	while(busyWorkers > 0)
+		batchFinished.wait(lock);
+}
+
+void ParallelPainter::work(int index)
+{
+	long lastBatch = 0;
+	while(true)
+	{
+		{
+			unique_lock<mutex> lock(batchMutex);
+			while(!stopping && batchNumber == lastBatch)
+				batchStarted.wait(lock);
+			if(stopping) return;
+			lastBatch = batchNumber;
+		}
+
+		drawSlice(index);
+
+		{
+			lock_guard<mutex> lock(batchMutex);
+			if(--busyWorkers == 0)
+				batchFinished.notify_all();
+		}
+	}
+}
+
+// Every worker draws one contiguous slice of the columns of the batch
+void ParallelPainter::drawSlice(int index)
+{
+	int threads = painters.size();
+	int begin = long(batchColumns) * index / threads;
+	int end = long(batchColumns) * (index + 1) / threads;
+	if(begin == end) return;
+
+	SpectrumPainter *painter = painters[index];
+	painter->startAtColumn(batchColumn + begin);
+	if(batchMagnitudes)
+		painter->feedWithMagnitudes(batchMagnitudes + long(begin) * (settings.fftSize / 2), end - begin);
+	else
+		painter->feedWithInput(&batchInput[long(begin) * settings.windowInc],
+			(end - begin - 1) * settings.windowInc + settings.fftSize);
+}
+
+// Starts over on another surface of the same height and format, the
+// samples which are left from the previous one are dropped
+void ParallelPainter::setSurface(SDL_Surface *imageSurface)
+{
+	waitForBatch();
+	pending.clear();
+	pendingColumn = 0;
+	for(int i = 0; i < painters.size(); ++i)
+		painters[i]->setSurface(imageSurface);
+}
+
+void ParallelPainter::setFirstColumn(long column)
+{
+	waitForBatch();
+	for(int i = 0; i < painters.size(); ++i)
+		painters[i]->setFirstColumn(column);
+}
+
+void ParallelPainter::drawLabeling(SDL_Surface *surface)
+{
+	waitForBatch();
+	painters[0]->drawLabeling(surface);
+}
@@ -0,0 +1,57 @@
+#ifndef PARALLELPAINTER_HPP
+#define PARALLELPAINTER_HPP
+
+#include "spectrumpainter.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Offline counterpart of SpectrumPainter which splits the columns of the
+// image between several worker threads. Every worker owns a SpectrumPainter
+// with its own block and window, and draws its slice of columns directly
+// into the shared image, so the result is identical to a single painter.
+// The workers live as long as the painter, also when it moves on to the
+// next surface of a tiled image. A batch is handed to them and painted in
+// the background while the caller reads the next input, only the following
+// batch waits for it to finish.
+class ParallelPainter
+{
+public:
+	ParallelPainter(SDL_Surface *imageSurface, const Settings &settings);
+	~ParallelPainter();
+	void feedWithInput(const vector<float> &input);
+	void feedWithInput(const float *input, int count);
+	void feedWithMagnitudes(const float *magnitudes, int columns);
+	void setSurface(SDL_Surface *imageSurface);
+	void setFirstColumn(long column);
+	void flush();
+	void drawLabeling(SDL_Surface *surface);
+private:
+	void drawColumns(int columns);
+	void startBatch(long column, int columns);
+	void waitForBatch();
+	void work(int index);
+	void drawSlice(int index);
+
+	vector<SpectrumPainter*> painters;
+	vector<thread> workers;
+	vector<float> pending;
+	long pendingColumn;
+	int columnsPerBatch;
+
+	// The batch the workers are painting, either samples or magnitudes
+	vector<float> batchInput;
+	const float *batchMagnitudes;
+	long batchColumn;
+	int batchColumns;
+
+	mutex batchMutex;
+	condition_variable batchStarted, batchFinished;
+	long batchNumber;
+	int busyWorkers;
+	bool stopping;
+
+	Settings settings;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "pyramid.hpp"
+#include <sys/stat.h>
+#include <fstream>
+#include <algorithm>
+
+PyramidWriter::PyramidWriter(const string &name, long width, int height, int tileSize, bool maxPooling,
+	const Settings &settings)
+{
+	this->name = name;
+	this->width = width;
+	this->height = height;
+	this->tileSize = tileSize;
+	this->maxPooling = maxPooling;
+	this->settings = settings;
+
+	// Level 0 is a single pixel, every level doubles the size of the previous one
+	levels = 1;
+	while((1L << (levels - 1)) < max(width, long(height)))
+		++levels;
+	pending.assign(levels, NULL);
+	stripsWritten.assign(levels, 0);
+
+	mkdir((name + "_files").c_str(), 0755);
+	for(int level = 0; level < levels; ++level)
+		mkdir(levelDirectory(level).c_str(), 0755);
+}
+
+PyramidWriter::~PyramidWriter()
+{
+	for(int level = 0; level < levels; ++level)
+		delete pending[level];
+}
+
+string PyramidWriter::levelDirectory(int level)
+{
+	return name + "_files/" + toString(level);
+}
+
+// Takes the palette indices of the next strip of the full resolution
+// image, which is tileSize columns wide except for the last one
+void PyramidWriter::addStrip(const Uint16 *indices, int stripWidth)
+{
+	Strip *strip = new Strip;
+	strip->w = stripWidth;
+	strip->h = height;
+	strip->indices.assign(indices, indices + long(stripWidth) * height);
+	addToLevel(levels - 1, strip);
+}
+
+void PyramidWriter::addToLevel(int level, Strip *strip)
+{
+	writeTiles(level, strip);
+	if(level == 0) {
+		delete strip;
+		return;
+	}
+
+	Strip *half = halve(strip);
+	delete strip;
+
+	if(pending[level - 1]) {
+		Strip *joined = join(pending[level - 1], half);
+		delete pending[level - 1];
+		delete half;
+		pending[level - 1] = NULL;
+		addToLevel(level - 1, joined);
+	}
+	else pending[level - 1] = half;
+}
+
+// Strips without a right neighbour are passed on alone, from the largest
+// level to the smallest, so that every level gets its last strip
+void PyramidWriter::finish()
+{
+	for(int level = levels - 1; level >= 0; --level) {
+		if(pending[level]) {
+			Strip *strip = pending[level];
+			pending[level] = NULL;
+			addToLevel(level, strip);
+		}
+	}
+
+	ofstream dzi((name + ".dzi").c_str());
+	dzi << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << endl;
+	dzi << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"png\" Overlap=\"0\" TileSize=\""
+		<< tileSize << "\">" << endl;
+	dzi << "\t<Size Width=\"" << width << "\" Height=\"" << height << "\"/>" << endl;
+	dzi << "</Image>" << endl;
+	Error::raiseIfNull(dzi.good(), "Could not write the DeepZoom descriptor");
+}
+
+// Every tile is colored through the palette the painter uses for the
+// full resolution image
+void PyramidWriter::writeTiles(int level, const Strip *strip)
+{
+	long column = stripsWritten[level]++;
+	for(int row = 0; row * tileSize < strip->h; ++row)
+	{
+		int top = row * tileSize;
+		int tileHeight = min(tileSize, strip->h - top);
+		SDL_Surface *tile = SpectrumPainter::createSurface(strip->w, tileHeight, settings);
+		if(palette.empty()) settings.colormap->bake(tile->format, palette);
+
+		SDL_LockSurface(tile);
+		int bytesPerPixel = tile->format->BytesPerPixel;
+		for(int y = 0; y < tileHeight; ++y)
+		{
+			const Uint16 *indices = &strip->indices[long(top + y) * strip->w];
+			Uint8 *p = static_cast<Uint8*>(tile->pixels) + long(y) * tile->pitch;
+			if(bytesPerPixel == 4) {
+				for(int x = 0; x < strip->w; ++x)
+					reinterpret_cast<Uint32*>(p)[x] = palette[indices[x]];
+			} else {
+				for(int x = 0; x < strip->w; ++x, p += 3) {
+					Uint32 color = palette[indices[x]];
+					p[0] = color & 0xff;
+					p[1] = (color >> 8) & 0xff;
+					p[2] = (color >> 16) & 0xff;
+				}
+			}
+		}
+		SDL_UnlockSurface(tile);
+
+		string filename = levelDirectory(level) + "/" + toString(column) + "_" + toString(row) + ".png";
+		IMG_SavePNG(tile, filename.c_str());
+		SDL_FreeSurface(tile);
+	}
+}
+
+// Pools every 2x2 block of indices into one. Odd sizes leave a last row or
+// column which is pooled from the indices that are there.
+PyramidWriter::Strip* PyramidWriter::halve(const Strip *strip)
+{
+	Strip *half = new Strip;
+	half->w = (strip->w + 1) / 2;
+	half->h = (strip->h + 1) / 2;
+	half->indices.resize(long(half->w) * half->h);
+
+	for(int y = 0; y < half->h; ++y)
+	{
+		const Uint16 *row0 = &strip->indices[long(2 * y) * strip->w];
+		const Uint16 *row1 = 2 * y + 1 < strip->h ? row0 + strip->w : row0;
+		Uint16 *output = &half->indices[long(y) * half->w];
+
+		for(int x = 0; x < half->w; ++x)
+		{
+			int left = 2 * x;
+			int right = 2 * x + 1 < strip->w ? left + 1 : left;
+			int a = row0[left], b = row0[right], d = row1[left], e = row1[right];
+			if(maxPooling)
+				output[x] = max(max(a, b), max(d, e));
+			else
+				output[x] = (a + b + d + e + 2) / 4;
+		}
+	}
+	return half;
+}
+
+PyramidWriter::Strip* PyramidWriter::join(const Strip *left, const Strip *right)
+{
+	Strip *joined = new Strip;
+	joined->w = left->w + right->w;
+	joined->h = left->h;
+	joined->indices.resize(long(joined->w) * joined->h);
+
+	for(int y = 0; y < joined->h; ++y)
+	{
+		Uint16 *output = &joined->indices[long(y) * joined->w];
+		copy(&left->indices[long(y) * left->w], &left->indices[long(y + 1) * left->w], output);
+		copy(&right->indices[long(y) * right->w], &right->indices[long(y + 1) * right->w], output + left->w);
+	}
+	return joined;
+}
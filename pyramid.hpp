@@ -0,0 +1,58 @@
+#ifndef PYRAMID_HPP
+#define PYRAMID_HPP
+
+#include "spectrumpainter.hpp"
+#include <vector>
+#include <string>
+
+using namespace std;
+
+// Writes a spectrogram as a DeepZoom tile pyramid (name.dzi with the tiles
+// in name_files/level/column_row.png) in a single pass. The full resolution
+// image arrives as strips of tileSize columns from left to right, given as
+// the palette indices the painter drew (see Settings::indices). Every strip
+// is cut into tiles, then halved in both directions by pooling 2x2 indices,
+// either taking the maximum or the mean. Pooling the indices rather than
+// the colors keeps every pixel of the smaller levels on the color map. Two
+// halved strips make up one strip of the next smaller level, so only one
+// strip per level is kept in memory.
+class PyramidWriter
+{
+public:
+	PyramidWriter(const string &name, long width, int height, int tileSize, bool maxPooling,
+		const Settings &settings);
+	~PyramidWriter();
+
+	void addStrip(const Uint16 *indices, int stripWidth);
+	void finish();
+
+	int getLevels() const {return levels;}
+
+private:
+	// Palette indices of a strip, row by row from the top
+	struct Strip
+	{
+		int w, h;
+		vector<Uint16> indices;
+	};
+
+	void addToLevel(int level, Strip *strip);
+	void writeTiles(int level, const Strip *strip);
+	Strip* halve(const Strip *strip);
+	Strip* join(const Strip *left, const Strip *right);
+	string levelDirectory(int level);
+
+	string name;
+	long width;
+	int height, tileSize, levels;
+	bool maxPooling;
+	Settings settings;
+	vector<Uint32> palette;
+
+	// Per level: the halved strip which waits for its right neighbour and
+	// the number of strips written so far
+	vector<Strip*> pending;
+	vector<long> stripsWritten;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "recordingstore.hpp"
+#include "spectrumpainter.hpp"
+#include <cstdio>
+#include <algorithm>
+
+RecordingStore::RecordingStore(int sampleRate, int channels, int pageFrames)
+{
+	this->sampleRate = sampleRate;
+	this->channels = channels;
+	this->pageFrames = pageFrames;
+	file = NULL;
+	sf = NULL;
+	current = NULL;
+
+	// A few spare pages cover the time the writer needs for one page
+	for(int i = 0; i < 4; ++i)
+		freePages.push_back(new Page());
+	for(int i = 0; i < freePages.size(); ++i)
+		freePages[i]->samples.resize(pageFrames * channels);
+
+	openFile();
+}
+
+RecordingStore::~RecordingStore()
+{
+	closeFile();
+	for(int i = 0; i < freePages.size(); ++i)
+		delete freePages[i];
+}
+
+void RecordingStore::openFile()
+{
+	// Wave64 has 64 bit chunk sizes, a WAV file ends at 4 GB (6.7 hours of
+	// 44.1 kHz stereo)
+	SF_INFO sfinfo;
+	sfinfo.format = SF_FORMAT_W64 | SF_FORMAT_PCM_16;
+	sfinfo.samplerate = sampleRate;
+	sfinfo.channels = channels;
+	// A file of its own for every store, which is deleted when it is closed,
+	// even if the program crashes
+	file = tmpfile();
+	Error::raiseIfNull(file, "Could not create the temporary recording file");
+	sf = sf_open_fd(fileno(file), SFM_RDWR, &sfinfo, SF_FALSE);
+	if(!sf) {
+		fclose(file);
+		throw Error("sf_open failed for the recording file");
+	}
+
+	framesTotal = 0;
+	framesOnDisk = 0;
+	writeError.clear();
+	current = newPage(0);
+	stop = false;
+	writer = thread(&RecordingStore::writerLoop, this);
+}
+
+// Stops the writer and deletes the temporary file, pending pages are dropped
+void RecordingStore::closeFile()
+{
+	{
+		lock_guard<mutex> lock(pageMutex);
+		stop = true;
+	}
+	pageReady.notify_one();
+	writer.join();
+
+	while(!fullPages.empty()) {
+		freePages.push_back(fullPages.front());
+		fullPages.pop_front();
+	}
+	freePages.push_back(current);
+	current = NULL;
+
+	sf_close(sf);
+	sf = NULL;
+	fclose(file);
+	file = NULL;
+}
+
+RecordingStore::Page* RecordingStore::newPage(long start)
+{
+	Page *page;
+	if(freePages.empty()) {
+		page = new Page();
+		page->samples.resize(pageFrames * channels);
+	} else {
+		page = freePages.back();
+		freePages.pop_back();
+	}
+	page->start = start;
+	page->frames = 0;
+	return page;
+}
+
+// Once writing has failed, further samples are dropped, so the recording
+// ends where the file does and memory usage stays bounded
+void RecordingStore::append(const short *samples, int frames)
+{
+	bool pageFull = false;
+	{
+		lock_guard<mutex> lock(pageMutex);
+		if(!writeError.empty()) return;
+		while(frames > 0)
+		{
+			int count = min(frames, pageFrames - current->frames);
+			copy(samples, samples + count * channels,
+				current->samples.begin() + current->frames * channels);
+			current->frames += count;
+			framesTotal += count;
+			samples += count * channels;
+			frames -= count;
+
+			if(current->frames == pageFrames) {
+				fullPages.push_back(current);
+				current = newPage(framesTotal);
+				pageFull = true;
+			}
+		}
+	}
+	if(pageFull) pageReady.notify_one();
+}
+
+long RecordingStore::getFrames()
+{
+	lock_guard<mutex> lock(pageMutex);
+	return framesTotal;
+}
+
+// Empty as long as every page was written
+string RecordingStore::getError()
+{
+	lock_guard<mutex> lock(pageMutex);
+	return writeError;
+}
+
+void RecordingStore::copyFromPage(const Page *page, long start, short *output, int frames)
+{
+	long begin = max(start, page->start);
+	long end = min(start + frames, page->start + page->frames);
+	if(begin >= end) return;
+	copy(page->samples.begin() + (begin - page->start) * channels,
+		page->samples.begin() + (end - page->start) * channels,
+		output + (begin - start) * channels);
+}
+
+// Reads frames starting at start, from memory as far as the pages are
+// still there and from the file for everything written already.
+int RecordingStore::read(long start, short *output, int frames)
+{
+	long diskFrames;
+	{
+		lock_guard<mutex> lock(pageMutex);
+		frames = int(max(0L, min(long(frames), framesTotal - start)));
+		diskFrames = framesOnDisk;
+		for(int i = 0; i < fullPages.size(); ++i)
+			copyFromPage(fullPages[i], start, output, frames);
+		copyFromPage(current, start, output, frames);
+	}
+
+	// Written frames never change, so the file is read without pageMutex
+	if(start < diskFrames && frames > 0) {
+		lock_guard<mutex> lock(fileMutex);
+		sf_seek(sf, start, SEEK_SET | SFM_READ);
+		sf_readf_short(sf, output, min(long(frames), diskFrames - start));
+	}
+	return frames;
+}
+
+void RecordingStore::writerLoop()
+{
+	for(;;)
+	{
+		Page *page;
+		{
+			unique_lock<mutex> lock(pageMutex);
+			while(!stop && fullPages.empty())
+				pageReady.wait(lock);
+			if(stop) return;
+			page = fullPages.front();
+		}
+
+		sf_count_t written;
+		string error;
+		{
+			lock_guard<mutex> lock(fileMutex);
+			sf_seek(sf, page->start, SEEK_SET | SFM_WRITE);
+			written = sf_writef_short(sf, &page->samples[0], page->frames);
+			if(written != page->frames) error = sf_strerror(sf);
+		}
+
+		// A full disk ends the writer. The page stays queued, so everything
+		// recorded so far can still be read.
+		if(written != page->frames) {
+			lock_guard<mutex> lock(pageMutex);
+			writeError = "Writing the recording failed: " + error;
+			return;
+		}
+
+		{
+			lock_guard<mutex> lock(pageMutex);
+			fullPages.pop_front();
+			framesOnDisk = page->start + page->frames;
+			freePages.push_back(page);
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef RECORDINGSTORE_HPP
+#define RECORDINGSTORE_HPP
+
+#include <sndfile.h>
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// Recording of unlimited length with constant memory usage. Samples are
+// collected in fixed-size pages; full pages are handed to a background
+// thread which appends them to a temporary Wave64 file and recycles them.
+// Any range of the recording can be read back, wherever it currently is.
+class RecordingStore
+{
+public:
+	RecordingStore(int sampleRate, int channels, int pageFrames = 32768);
+	~RecordingStore();
+
+	void append(const short *samples, int frames);
+	int read(long start, short *output, int frames);
+	long getFrames();
+	string getError();
+
+private:
+	struct Page
+	{
+		vector<short> samples;
+		long start;
+		int frames;
+	};
+
+	void openFile();
+	void closeFile();
+	void writerLoop();
+	Page* newPage(long start);
+	void copyFromPage(const Page *page, long start, short *output, int frames);
+
+	int sampleRate, channels, pageFrames;
+	FILE *file;
+	SNDFILE *sf;
+
+	mutex pageMutex, fileMutex;
+	condition_variable pageReady;
+	Page *current;
+	deque<Page*> fullPages;
+	vector<Page*> freePages;
+	long framesTotal, framesOnDisk;
+	string writeError;
+	bool stop;
+	thread writer;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef RINGBUFFER_HPP
+#define RINGBUFFER_HPP
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// Wait-free ring buffer for exactly one producer and one consumer thread.
+// All memory is allocated in the constructor; write and read never lock or
+// allocate, so the producer may be a realtime audio callback.
+template<class T>
+class RingBuffer
+{
+public:
+	// The capacity is rounded up to a power of 2
+	RingBuffer(int capacity)
+	{
+		int size = 1;
+		while(size < capacity) size <<= 1;
+		buffer.resize(size);
+		mask = size - 1;
+		head = 0;
+		tail = 0;
+	}
+
+	// Producer side: stores all count elements or, if they do not fit,
+	// nothing at all and returns false.
+	bool write(const T *data, int count)
+	{
+		size_t h = head.load(memory_order_relaxed);
+		size_t t = tail.load(memory_order_acquire);
+		if(buffer.size() - (h - t) < size_t(count))
+			return false;
+
+		for(int i = 0; i < count; ++i)
+			buffer[(h + i) & mask] = data[i];
+		head.store(h + count, memory_order_release);
+		return true;
+	}
+
+	// Consumer side: reads up to count elements and returns their number
+	int read(T *data, int count)
+	{
+		size_t t = tail.load(memory_order_relaxed);
+		size_t h = head.load(memory_order_acquire);
+		count = int(min(size_t(count), h - t));
+
+		for(int i = 0; i < count; ++i)
+			data[i] = buffer[(t + i) & mask];
+		tail.store(t + count, memory_order_release);
+		return count;
+	}
+
+	// Consumer side: number of elements which can be read
+	int available() const
+	{
+		return int(head.load(memory_order_acquire) - tail.load(memory_order_relaxed));
+	}
+
+	int capacity() const {return buffer.size();}
+
+private:
+	vector<T> buffer;
+	size_t mask;
+	// Producer and consumer positions on separate cache lines
+	alignas(64) atomic<size_t> head;
+	alignas(64) atomic<size_t> tail;
+};
+
+#endif
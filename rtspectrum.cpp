@@ -8,23 +8,51 @@
 #include <iomanip>
 #include <cstdlib>
 #include <ctime>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 
 #include "spectrumpainter.hpp"
+#include "ringbuffer.hpp"
+#include "recordingstore.hpp"
+#include "tilestore.hpp"
 
 using namespace std;
 
+// Longer spectrum images are saved as tiles of this many columns, so the
+// whole image is never in memory
+static const int SAVE_TILE_COLUMNS = 16384;
+
+// Everything one press of S saves. The stores are shared, so a reset while
+// the job waits in the queue starts new stores and leaves these intact.
+struct ExportJob
+{
+	string audioFilename, imageFilename;
+	shared_ptr<RecordingStore> recording;
+	long frames;
+	shared_ptr<TileStore> tiles;
+	TileStore::Snapshot snapshot;
+	Settings settings;
+};
+
+
 class RTSpectrumApp
 {
 public:
-	RTSpectrumApp();
+	RTSpectrumApp(const Settings &settings);
 	~RTSpectrumApp();	
 	void run();
 private:
 	void initializeSDL();
 	void finalizeSDL();
 	
+	void updateTexture();
 	void drawSpectrum();
 	void drawLabels();
+	void drawText(const string &text, int x, int y);
 
 	void onKeyDown(const SDL_Event &event);
 	void onKeyUp(const SDL_Event &event);
@@ -33,23 +61,53 @@ private:
 	friend void globalAudioCallback(void *userdata, Uint8 *data, int length);
 	void processAudio();
 
+	void createStores();
 	void clearRecording();
-	void saveAudioRecording(const string &filename);
-	void saveSpectrumImage(const string &filename);
+	void saveRecording(const string &name);
+	void exportLoop();
+	void saveAudioRecording(const ExportJob &job);
+	void saveSpectrumImage(const ExportJob &job);
+	void saveSpectrumTile(const ExportJob &job, const Settings &settings, long firstColumn, int width,
+		const string &filename);
 	string timeString(time_t t);
 	
 	SDL_Renderer *renderer;
 	SDL_Window *sdlWindow;
-	SDL_Surface *screenSurface, *imageSurface;
+	SDL_Surface *imageSurface;
+
+	// Copy of imageSurface in the renderer. Only the columns drawn since the
+	// last frame are uploaded, texturedColumns counts the columns already there.
+	SDL_Texture *spectrumTexture;
+	long texturedColumns;
+	LabelCache *labelCache;
 	SDL_AudioSpec want, have;
 	SDL_AudioDeviceID audioDevice;
-	TTF_Font *font;
-	bool quit, recording;
+	TTF_Font *font, *saveFont;
+	bool quit;
+	atomic<bool> recording;
 
 	int screenWidth, screenHeight;
 
-	vector<Sint16> audioData;
-	int audioProcessed;
+	// Filled by the audio callback, drained by processAudio
+	RingBuffer<Sint16> captureBuffer;
+	atomic<long> overruns;
+
+	// Everything recorded and drawn since the last reset, spilled to
+	// temporary files. A reset replaces both with new ones.
+	shared_ptr<RecordingStore> recordingStore;
+	shared_ptr<TileStore> tileStore;
+
+	// Saves are done one after another on exportThread, which has a font
+	// of its own for the labels
+	deque<ExportJob> exportJobs;
+	mutex exportMutex;
+	condition_variable exportReady;
+	thread exportThread;
+	bool exportStop;
+	atomic<int> exportsPending, exportPercent;
+
+	vector<Sint16> samples;
+	vector<float> input;
 
 	Settings settings;
 	SpectrumPainter *spectrumPainter;
@@ -61,21 +119,46 @@ void globalAudioCallback(void *userdata, Uint8 *data, int length)
 	reinterpret_cast<RTSpectrumApp*>(userdata)->audioCallback(data, length);
 }
 
-RTSpectrumApp::RTSpectrumApp()
+RTSpectrumApp::RTSpectrumApp(const Settings &settings)
+	: captureBuffer(4 * settings.sampleRate * settings.channels)
 {
+	this->settings = settings;
+	this->settings.wrapAround = true;
 	quit = recording = false;
+	overruns = 0;
 	screenWidth = 1200;
 	screenHeight = int(settings.upperFreqLimit / settings.freqResolution) + 1;
 
-	audioProcessed = 0;
+	samples.resize(captureBuffer.capacity());
+	input.reserve(captureBuffer.capacity());
 	
 	initializeSDL();
-	spectrumPainter = new SpectrumPainter(imageSurface, settings);
+	spectrumPainter = new SpectrumPainter(imageSurface, this->settings);
+	SDL_UpdateTexture(spectrumTexture, NULL, imageSurface->pixels, imageSurface->pitch);
+
+	createStores();
+
+	exportStop = false;
+	exportsPending = 0;
+	exportPercent = 0;
+	exportThread = thread(&RTSpectrumApp::exportLoop, this);
 }
 
 
 RTSpectrumApp::~RTSpectrumApp()
 {
+	// Saves which were asked for are still completed
+	if(exportsPending > 0)
+		cout << "Waiting for " << exportsPending << " saves to complete" << endl;
+	{
+		lock_guard<mutex> lock(exportMutex);
+		exportStop = true;
+	}
+	exportReady.notify_one();
+	exportThread.join();
+
+	recordingStore.reset();
+	tileStore.reset();
 	delete spectrumPainter;
 	finalizeSDL();
 }
@@ -91,10 +174,20 @@ void RTSpectrumApp::initializeSDL()
 	sdlWindow = SDL_CreateWindow("Spectrum", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
 		screenWidth, screenHeight, SDL_WINDOW_SHOWN);
 	Error::raiseIfNull(sdlWindow, "SDL_CreateWindow failed");
-	screenSurface = SDL_GetWindowSurface(sdlWindow);
-	Error::raiseIfNull(screenSurface, "SDL_GetWindowSurface failed");
-	imageSurface = SDL_CreateRGBSurface(0, screenWidth, screenHeight, 24, 0x000000ff, 0x0000ff00, 0x00ff0000, 0);	
+
+	// Without a usable driver, SDL's software renderer does the same job
+	renderer = SDL_CreateRenderer(sdlWindow, -1, 0);
+	if(!renderer) renderer = SDL_CreateRenderer(sdlWindow, -1, SDL_RENDERER_SOFTWARE);
+	Error::raiseIfNull(renderer, "SDL_CreateRenderer failed");
+	labelCache = new LabelCache(renderer);
+
+	// Same pixel format for surface and texture, so uploads need no conversion
+	imageSurface = SDL_CreateRGBSurface(0, screenWidth, screenHeight, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0);	
 	Error::raiseIfNull(imageSurface, "SDL_CreateRGBSurface failed");
+	spectrumTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING,
+		screenWidth, screenHeight);
+	Error::raiseIfNull(spectrumTexture, "SDL_CreateTexture failed");
+	texturedColumns = 0;
 
 	// Initialize Image
 	result = IMG_Init(IMG_INIT_PNG);
@@ -105,6 +198,8 @@ void RTSpectrumApp::initializeSDL()
 	Error::raiseIfNotNull(result, "TTF_Init failed");
     font = TTF_OpenFont("OpenSans-Regular.ttf", 16);
 	Error::raiseIfNull(font, "TTF_OpenFont failed");
+	saveFont = TTF_OpenFont("OpenSans-Regular.ttf", 16);
+	Error::raiseIfNull(saveFont, "TTF_OpenFont failed");
 	settings.font = font;
 	settings.labels = true;
 	
@@ -125,9 +220,13 @@ void RTSpectrumApp::initializeSDL()
 
 void RTSpectrumApp::finalizeSDL()
 {
+	delete labelCache;
 	TTF_CloseFont(font);
+	TTF_CloseFont(saveFont);
 	TTF_Quit();
 	
+	SDL_DestroyTexture(spectrumTexture);
+	SDL_DestroyRenderer(renderer);
 	SDL_FreeSurface(imageSurface);
     SDL_CloseAudioDevice(audioDevice);
     SDL_Quit();
@@ -151,13 +250,14 @@ void RTSpectrumApp::run()
 		}
 
 		processAudio();
+		drawSpectrum();
 		if(settings.labels) drawLabels();
 
 		const float deltaTime = 0.04; 
 		int endTime = SDL_GetTicks();
 		if(endTime - startTime < deltaTime * 1000)
 			SDL_Delay(deltaTime * 1000 - (endTime - startTime));
-		SDL_UpdateWindowSurface(sdlWindow);
+		SDL_RenderPresent(renderer);
 	}
 }
 
@@ -177,9 +277,7 @@ void RTSpectrumApp::onKeyDown(const SDL_Event &event)
 			settings.labels = !settings.labels;
 			break;
 		case SDLK_s:
-			string timeStr = timeString(time(0));
-			saveAudioRecording(string("recording-") + timeStr + ".ogg");
-			saveSpectrumImage(string("recording-") + timeStr + ".png");
+			saveRecording(string("recording-") + timeString(time(0)));
 			break;
 	}
 }
@@ -193,32 +291,78 @@ void RTSpectrumApp::onKeyUp(const SDL_Event &event)
 	}
 }
 
+// Runs on the audio thread: no locks and no allocations. If the render
+// thread falls behind and the ring buffer is full, the block is dropped
+// and counted as an overrun.
 void RTSpectrumApp::audioCallback(Uint8 *data, int bytes)
 {
 	if(recording) {
-		int samples = bytes / sizeof(Sint16);
-		for(int i = 0; i < samples; ++i)
-			audioData.push_back(reinterpret_cast<Sint16*>(data)[i]);
+		int count = bytes / sizeof(Sint16);
+		if(!captureBuffer.write(reinterpret_cast<Sint16*>(data), count))
+			++overruns;
 	}
 }
 
 void RTSpectrumApp::processAudio()
 {
-	vector<float> input;
-	SDL_LockAudioDevice(audioDevice);
-	while(audioProcessed < audioData.size())
-	{
-		float monoSample = 0.0;
-		for(int j = 0; j < settings.channels; ++j)
-			monoSample += audioData[audioProcessed + j];
-		monoSample /= 32768.0f * settings.channels;
-		input.push_back(monoSample);
-		audioProcessed += settings.channels;	
-	}
-	SDL_UnlockAudioDevice(audioDevice);
+	int count = captureBuffer.available();
+	count -= count % settings.channels;
+	count = captureBuffer.read(&samples[0], count);
+
+	recordingStore->append(&samples[0], count / settings.channels);
+	SpectrumPainter::mixToMono(&samples[0], count / settings.channels, settings.channels, input);
 	
+	SDL_LockSurface(imageSurface);
 	spectrumPainter->feedWithInput(input);
-	SDL_BlitSurface(imageSurface, NULL, screenSurface, NULL);
+	SDL_UnlockSurface(imageSurface);
+	tileStore->update(imageSurface, *spectrumPainter);
+	updateTexture();
+}
+
+void RTSpectrumApp::updateTexture()
+{
+	long columnsDrawn = spectrumPainter->getColumnsDrawn();
+	long column = max(texturedColumns, spectrumPainter->getFirstVisibleColumn());
+	int bytesPerPixel = imageSurface->format->BytesPerPixel;
+
+	// One upload per run of columns, the run ends where the image wraps around
+	while(column < columnsDrawn)
+	{
+		SDL_Rect rect;
+		rect.x = spectrumPainter->getColumnX(column);
+		rect.y = 0;
+		rect.w = int(min(columnsDrawn - column, long(imageSurface->w - rect.x)));
+		rect.h = imageSurface->h;
+		SDL_UpdateTexture(spectrumTexture, &rect,
+			static_cast<Uint8*>(imageSurface->pixels) + rect.x * bytesPerPixel, imageSurface->pitch);
+		column += rect.w;
+	}
+	texturedColumns = columnsDrawn;
+}
+
+// The texture holds the wrap around image, so it is drawn in two parts
+// split at the oldest column
+void RTSpectrumApp::drawSpectrum()
+{
+	long firstColumn = spectrumPainter->getFirstVisibleColumn();
+	int split = firstColumn > 0 ? spectrumPainter->getColumnX(firstColumn) : 0;
+
+	SDL_Rect srcrect, dstrect;
+	srcrect.x = split;
+	srcrect.y = 0;
+	srcrect.w = screenWidth - split;
+	srcrect.h = screenHeight;
+	dstrect = srcrect;
+	dstrect.x = 0;
+	SDL_RenderCopy(renderer, spectrumTexture, &srcrect, &dstrect);
+
+	if(split > 0) {
+		srcrect.x = 0;
+		srcrect.w = split;
+		dstrect = srcrect;
+		dstrect.x = screenWidth - split;
+		SDL_RenderCopy(renderer, spectrumTexture, &srcrect, &dstrect);
+	}
 }
 
 
@@ -227,54 +371,170 @@ void RTSpectrumApp::drawLabels()
 	string text = string("Last ") + toString(settings.timeResolution * screenWidth) + " sec, ";
 	text += string("0 - ") + toString(settings.freqResolution * screenHeight) + " Hz";
 	text += " Keys: Space = record, s = Save, r = Reset, l = Labels";
-	SDL_Color textColor = { 255, 255, 255, 255 };
-	SDL_Surface* textSurface = TTF_RenderText_Blended(font, text.c_str(), textColor);
-	
-	Error::raiseIfNull(textSurface, "TTF_RenderText_Solid failed");
+	if(overruns > 0) text += ", Overruns: " + toString(overruns.load());
+	string recordingError = recordingStore->getError();
+	if(!recordingError.empty()) text += ", " + recordingError;
+	if(exportsPending > 0) {
+		text += ", Saving " + toString(exportPercent.load()) + "%";
+		if(exportsPending > 1) text += " (" + toString(exportsPending - 1) + " queued)";
+	}
+	drawText(text, 0, 0);
+
+	vector<Label> labels;
+	spectrumPainter->getLabels(screenWidth, screenHeight, labels);
+	for(int i = 0; i < labels.size(); ++i)
+		drawText(labels[i].text, labels[i].x, labels[i].y);
+}
+
+void RTSpectrumApp::drawText(const string &text, int x, int y)
+{
 	SDL_Rect dstrect;
-	dstrect.x = 0;
-	dstrect.y = 0;			
-	SDL_BlitSurface(textSurface, NULL, screenSurface, &dstrect);
-	SDL_FreeSurface(textSurface);
+	dstrect.x = x;
+	dstrect.y = y;
+	dstrect.w = labelCache->getSurface(font, text)->w;
+	dstrect.h = labelCache->getSurface(font, text)->h;
+	SDL_RenderCopy(renderer, labelCache->getTexture(font, text), NULL, &dstrect);
+}
 
-	spectrumPainter->drawLabeling(screenSurface);
+void RTSpectrumApp::createStores()
+{
+	recordingStore = make_shared<RecordingStore>(settings.sampleRate, settings.channels);
+	tileStore = make_shared<TileStore>(imageSurface);
 }
 
 void RTSpectrumApp::clearRecording()
 {
-	SDL_LockAudioDevice(audioDevice);
-	audioProcessed = 0;
-	audioData.clear();
-	SDL_UnlockAudioDevice(audioDevice);
+	while(captureBuffer.read(&samples[0], samples.size()) > 0);
+	createStores();
+	overruns = 0;
 
 	spectrumPainter->reset();	
+	SDL_UpdateTexture(spectrumTexture, NULL, imageSurface->pixels, imageSurface->pitch);
+	texturedColumns = 0;
+}
+
+
+// Queues the recording as it is now. Only the snapshot is taken here,
+// the files are written on exportThread.
+void RTSpectrumApp::saveRecording(const string &name)
+{
+	ExportJob job;
+	job.audioFilename = name + ".ogg";
+	job.imageFilename = name + ".png";
+	job.recording = recordingStore;
+	job.frames = recordingStore->getFrames();
+	job.tiles = tileStore;
+	job.snapshot = tileStore->takeSnapshot();
+	job.settings = settings;
+	job.settings.font = saveFont;
+
+	{
+		lock_guard<mutex> lock(exportMutex);
+		exportJobs.push_back(job);
+		++exportsPending;
+	}
+	exportReady.notify_one();
 }
 
+void RTSpectrumApp::exportLoop()
+{
+	for(;;)
+	{
+		ExportJob job;
+		{
+			unique_lock<mutex> lock(exportMutex);
+			while(!exportStop && exportJobs.empty())
+				exportReady.wait(lock);
+			if(exportJobs.empty()) return;
+			job = exportJobs.front();
+			exportJobs.pop_front();
+		}
+
+		try {
+			exportPercent = 0;
+			saveAudioRecording(job);
+			saveSpectrumImage(job);
+		}
+		catch(Error e) {
+			cout << "Error: " << e.getMessage() << endl;
+		}
+		TileStore::freeSnapshot(job.snapshot);
+		--exportsPending;
+	}
+}
 
-void RTSpectrumApp::saveAudioRecording(const string &filename)
+void RTSpectrumApp::saveAudioRecording(const ExportJob &job)
 {
-	cout << "Saving audio recording: " << filename << endl;
+	cout << "Saving audio recording: " << job.audioFilename << endl;
 	
 	SF_INFO sf_info;
 	sf_info.format = SF_FORMAT_OGG | SF_FORMAT_VORBIS;
-	sf_info.samplerate = settings.sampleRate;
-	sf_info.channels = settings.channels;
-	SNDFILE *sf = sf_open(filename.c_str(), SFM_WRITE, &sf_info);
+	sf_info.samplerate = job.settings.sampleRate;
+	sf_info.channels = job.settings.channels;
+	SNDFILE *sf = sf_open(job.audioFilename.c_str(), SFM_WRITE, &sf_info);
 	Error::raiseIfNull(sf, "sf_open failed");
 
-	for(int i = 0; i < audioData.size(); i += settings.channels)
-		sf_writef_short(sf, &audioData[i], 1);
+	// Encoding is the slow part, the image only takes the last few percent
+	int chunkFrames = job.settings.sampleRate;
+	vector<Sint16> chunk(chunkFrames * job.settings.channels);
+	for(long i = 0; i < job.frames; i += chunkFrames) {
+		int count = job.recording->read(i, &chunk[0], int(min(long(chunkFrames), job.frames - i)));
+		if(sf_writef_short(sf, &chunk[0], count) != count) {
+			sf_close(sf);
+			throw Error("Writing the audio recording failed");
+		}
+		exportPercent = int(90 * (i + count) / job.frames);
+	}
 	sf_close(sf);
 }
 
+// The columns are already in the tile store, so only the labels and the
+// PNG encoding are left to do. Recordings longer than SAVE_TILE_COLUMNS
+// are saved as tiles with a manifest, like audio2image -tiles does.
+void RTSpectrumApp::saveSpectrumImage(const ExportJob &job)
+{
+	// Labels count from the start of the recording, not from the live view
+	Settings settings = job.settings;
+	settings.wrapAround = false;
+	long columns = max(1L, job.snapshot.columns);
+
+	if(columns <= SAVE_TILE_COLUMNS) {
+		cout << "Saving spectrum image: " << job.imageFilename << endl;
+		saveSpectrumTile(job, settings, 0, int(columns), job.imageFilename);
+	}
+	else {
+		string base = job.imageFilename.substr(0, job.imageFilename.size() - 4);
+		long tileCount = (columns + SAVE_TILE_COLUMNS - 1) / SAVE_TILE_COLUMNS;
+		cout << "Saving spectrum image as " << tileCount << " tiles: " << base << ".json" << endl;
+
+		vector<string> tileNames;
+		for(long tile = 0; tile < tileCount; ++tile) {
+			long firstColumn = tile * SAVE_TILE_COLUMNS;
+			stringstream name;
+			name << base << "-" << setfill('0') << setw(6) << tile << ".png";
+			saveSpectrumTile(job, settings, firstColumn, int(min(long(SAVE_TILE_COLUMNS), columns - firstColumn)),
+				name.str());
+			tileNames.push_back(name.str());
+			exportPercent = int(90 + 10 * (tile + 1) / tileCount);
+		}
+		SpectrumPainter::writeTileManifest(base, tileNames, columns, job.tiles->getHeight(), SAVE_TILE_COLUMNS,
+			settings);
+	}
+	exportPercent = 100;
+}
 
-void RTSpectrumApp::saveSpectrumImage(const string &filename)
+void RTSpectrumApp::saveSpectrumTile(const ExportJob &job, const Settings &settings, long firstColumn, int width,
+	const string &filename)
 {
-	cout << "Saving spectrum image: " << filename << endl;
+	SDL_Surface *image = job.tiles->createSurface(width);
+	SpectrumPainter painter(image, settings);
+	painter.setFirstColumn(firstColumn);
+	job.tiles->drawColumns(job.snapshot, firstColumn, image);
+	if(settings.labels) painter.drawLabeling(image);
 
-	SDL_Surface *image = SpectrumPainter::audioToImage(audioData, settings);
-	IMG_SavePNG(image, filename.c_str());	
+	int result = IMG_SavePNG(image, filename.c_str());
 	SDL_FreeSurface(image);
+	Error::raiseIfNotNull(result, "IMG_SavePNG failed");
 }
 
 
@@ -296,8 +556,20 @@ string RTSpectrumApp::timeString(time_t t)
 
 int main(int argc, char **argv)
 {
+	Settings settings;
+	for(int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if(arg == "-colormap" && i + 1 < argc) {
+			settings.colormap = Colormap::find(argv[++i]);
+			if(!settings.colormap) {
+				cout << "Error: unknown color map " << argv[i] << " (" << Colormap::getNames() << ")" << endl;
+				return 1;
+			}
+		}
+	}
+
 	try	{
-		RTSpectrumApp app;
+		RTSpectrumApp app(settings);
 		app.run();
 	}
 	catch(Error e) {
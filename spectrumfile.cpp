@@ -0,0 +1,133 @@
+#include "spectrumfile.hpp"
+#include "spectrumpainter.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cmath>
+
+SpectrumFile::SpectrumFile(const string &filename, long columns, const Settings &settings, bool halfFloat)
+{
+	this->columns = columns;
+	bins = settings.fftSize / 2;
+	bytesPerValue = halfFloat ? 2 : 4;
+	mappingSize = sizeof(SpectrumFileHeader) + size_t(columns) * bins * bytesPerValue;
+
+	file = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	Error::raiseIfNull(file >= 0, "Could not create the spectrum file");
+	Error::raiseIfNotNull(ftruncate(file, mappingSize), "Could not resize the spectrum file");
+	void *result = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	Error::raiseIfNull(result != MAP_FAILED, "Could not map the spectrum file");
+	mapping = static_cast<Uint8*>(result);
+	data = mapping + sizeof(SpectrumFileHeader);
+
+	SpectrumFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "A2ISPEC", 8);
+	header.version = 1;
+	header.bitsPerValue = bytesPerValue * 8;
+	header.sampleRate = settings.sampleRate;
+	header.fftSize = settings.fftSize;
+	header.windowInc = settings.windowInc;
+	header.bins = bins;
+	header.columns = columns;
+	header.tradeoff = settings.tradeoff;
+	memcpy(mapping, &header, sizeof(header));
+}
+
+SpectrumFile::SpectrumFile()
+{
+	file = -1;
+	mapping = data = NULL;
+}
+
+// Maps a file written before, read only. Returns NULL if there is none
+// or if it holds float16 values or was computed with other parameters.
+SpectrumFile* SpectrumFile::openExisting(const string &filename, long columns, const Settings &settings)
+{
+	int file = open(filename.c_str(), O_RDONLY);
+	if(file < 0) return NULL;
+
+	SpectrumFileHeader header;
+	size_t mappingSize = sizeof(header) + size_t(columns) * (settings.fftSize / 2) * sizeof(float);
+	struct stat info;
+	bool valid = read(file, &header, sizeof(header)) == sizeof(header) &&
+		fstat(file, &info) == 0 && info.st_size == mappingSize &&
+		memcmp(header.magic, "A2ISPEC", 8) == 0 && header.version == 1 && header.bitsPerValue == 32 &&
+		header.sampleRate == settings.sampleRate && header.fftSize == settings.fftSize &&
+		header.windowInc == settings.windowInc && header.tradeoff == settings.tradeoff &&
+		header.columns == columns;
+	void *result = valid ? mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+	if(result == MAP_FAILED) {
+		close(file);
+		return NULL;
+	}
+
+	SpectrumFile *spectrumFile = new SpectrumFile();
+	spectrumFile->file = file;
+	spectrumFile->mapping = static_cast<Uint8*>(result);
+	spectrumFile->data = spectrumFile->mapping + sizeof(SpectrumFileHeader);
+	spectrumFile->mappingSize = mappingSize;
+	spectrumFile->columns = columns;
+	spectrumFile->bins = header.bins;
+	spectrumFile->bytesPerValue = 4;
+	return spectrumFile;
+}
+
+const float* SpectrumFile::getColumn(long column) const
+{
+	return reinterpret_cast<const float*>(data + size_t(column) * bins * bytesPerValue);
+}
+
+SpectrumFile::~SpectrumFile()
+{
+	munmap(mapping, mappingSize);
+	close(file);
+}
+
+// Stores the magnitudes of one transformed frame, laid out like the output
+// of FFTPlan::rdft. Columns outside the file are ignored.
+void SpectrumFile::writeColumn(long column, const float *spectrum)
+{
+	if(column < 0 || column >= columns) return;
+
+	Uint8 *output = data + size_t(column) * bins * bytesPerValue;
+	if(bytesPerValue == 4) {
+		float *values = reinterpret_cast<float*>(output);
+		for(int i = 0; i < bins; ++i)
+			values[i] = magnitude(spectrum[i * 2], spectrum[i * 2 + 1]);
+	} else {
+		Uint16 *values = reinterpret_cast<Uint16*>(output);
+		for(int i = 0; i < bins; ++i)
+			values[i] = toHalf(magnitude(spectrum[i * 2], spectrum[i * 2 + 1]));
+	}
+}
+
+// IEEE 754 half precision, rounded to nearest even. Magnitudes are never
+// negative or NaN, but both are converted correctly anyway.
+Uint16 SpectrumFile::toHalf(float value)
+{
+	Uint32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	Uint16 sign = (bits >> 16) & 0x8000;
+	Uint32 magnitude = bits & 0x7fffffff;
+
+	if(magnitude >= 0x7f800000)
+		return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+	if(magnitude >= 0x477ff000)
+		return sign | 0x7c00;
+	if(magnitude < 0x38800000) {
+		// Subnormal halfs, the float is scaled so that rounding of the
+		// addition does the work
+		float scaled;
+		memcpy(&scaled, &magnitude, sizeof(scaled));
+		scaled += 0.5f;
+		Uint32 scaledBits;
+		memcpy(&scaledBits, &scaled, sizeof(scaledBits));
+		return sign | Uint16(scaledBits - 0x3f000000);
+	}
+
+	Uint32 rounding = 0xfff + ((magnitude >> 13) & 1);
+	return sign | Uint16((magnitude - 0x38000000 + rounding) >> 13);
+}
@@ -0,0 +1,56 @@
+#ifndef SPECTRUMFILE_HPP
+#define SPECTRUMFILE_HPP
+
+#include <SDL_stdinc.h>
+#include <string>
+#include <cmath>
+
+using namespace std;
+
+struct Settings;
+
+// Header of a raw spectrum file, followed by columns * bins magnitudes as
+// float32 or float16 in native byte order. One column holds the magnitudes
+// of bins 0 to fftSize/2 - 1 of one FFT window, columns are in time order.
+// The header is 64 bytes, so the data is aligned for mapping it directly.
+struct SpectrumFileHeader
+{
+	char magic[8];
+	Uint32 version, bitsPerValue;
+	Uint32 sampleRate, fftSize, windowInc, bins;
+	Uint64 columns;
+	float tradeoff;
+	Uint32 reserved[5];
+};
+
+// Raw magnitude spectra written alongside the image. The file is mapped
+// into memory, so painters on several threads can store their columns
+// directly at their place. Existing float32 files can be opened again to
+// draw images from them without repeating the FFTs.
+class SpectrumFile
+{
+public:
+	SpectrumFile(const string &filename, long columns, const Settings &settings, bool halfFloat = false);
+	~SpectrumFile();
+	static SpectrumFile* openExisting(const string &filename, long columns, const Settings &settings);
+
+	void writeColumn(long column, const float *spectrum);
+	const float* getColumn(long column) const;
+	int getBins() const {return bins;}
+
+	// Magnitude of a bin the way SpectrumPainter computes it, so an image
+	// drawn from stored magnitudes is identical to one drawn from the FFT
+	static float magnitude(float re, float im) {return sqrtf(re * re + im * im);}
+
+private:
+	SpectrumFile();
+	static Uint16 toHalf(float value);
+
+	int file;
+	Uint8 *mapping, *data;
+	size_t mappingSize;
+	long columns;
+	int bins, bytesPerValue;
+};
+
+#endif
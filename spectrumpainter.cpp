@@ -1,255 +1,508 @@
 #include "spectrumpainter.hpp"
 #include <iostream>
-
-void rdft(int n, int isgn, float *a);
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <map>
+#include <mutex>
 
 SpectrumPainter::SpectrumPainter(SDL_Surface *imageSurface, const Settings &settings)
+	: window(sharedWindow(settings.fftSize, settings.tradeoff)),
+	  fftPlan(FFTPlan::shared(settings.fftSize, settings.fftKernel))
 {
 	this->settings = settings;
 	this->imageSurface = imageSurface;
-	window.resize(settings.fftSize);
-	for(long i = 0; i < window.size(); ++i)
-		window[i] = windowFunc(float(i) / window.size());
+	spectra.resize(long(settings.batchFrames) * settings.fftSize);
+	preparePixelWriter();
 	reset();
 }
 
 
 void SpectrumPainter::feedWithInput(const vector<float> &input)
 {
-	for(int i = 0; i < input.size(); ++i)
-	{
-		block[blockPosition] = input[i];
-		++blockPosition;
-		++samplesProcessed;
+	feedWithInput(input.data(), input.size());
+}
 
-		if(blockPosition == block.size())
+// The block is a ring buffer of fftSize samples which is stored twice in a
+// row, so the most recent fftSize samples are always contiguous and a frame
+// can be windowed straight out of it without shifting the block.
+void SpectrumPainter::feedWithInput(const float *input, int count)
+{
+	const int size = settings.fftSize;
+	int frames = 0;
+	int i = 0;
+	while(i < count)
+	{
+		int run = min(count - i, min(size - blockFill, size - blockPosition));
+		copy(input + i, input + i + run, block.begin() + blockPosition);
+		copy(input + i, input + i + run, block.begin() + blockPosition + size);
+		blockPosition = (blockPosition + run) % size;
+		blockFill += run;
+		samplesProcessed += run;
+		i += run;
+
+		if(blockFill == size)
 		{
-			vector<float> spectrum;
-			frequencyAnalysis(block, spectrum);
-			spectrums.push_back(spectrum);
-			
-			for(long i = 0; i < block.size() - settings.windowInc; ++i)
-				block[i] = block[i + settings.windowInc];
-			blockPosition -= settings.windowInc;
+			float *frame = &spectra[long(frames) * size];
+			const float *samples = &block[blockPosition];
+			const float *weights = window->data();
+			for(int j = 0; j < size; ++j)
+				frame[j] = samples[j] * weights[j];
+			++frames;
+			blockFill -= settings.windowInc;
+
+			// The batch buffer is preallocated, draw it once it is full
+			if(frames == settings.batchFrames)
+			{
+				frequencyAnalysis(spectra.data(), frames);
+				drawSpectrogram(spectra.data(), frames);
+				frames = 0;
+			}
 		}
 	}
 
-	drawSpectrogram(spectrums);
-	spectrums.clear();
+	// All other frames which became ready are transformed in one batch
+	frequencyAnalysis(spectra.data(), frames);
+	drawSpectrogram(spectra.data(), frames);
+}
+
+// Draws count columns of fftSize / 2 magnitudes each, as stored in a
+// SpectrumFile. They are put into the spectrum layout with zero imaginary
+// parts, so they take the same drawing path as transformed input.
+void SpectrumPainter::feedWithMagnitudes(const float *magnitudes, int count)
+{
+	int bins = settings.fftSize / 2;
+	while(count > 0)
+	{
+		int frames = min(count, settings.batchFrames);
+		for(int i = 0; i < frames; ++i) {
+			float *spectrum = &spectra[long(i) * settings.fftSize];
+			for(int j = 0; j < bins; ++j) {
+				spectrum[j * 2] = magnitudes[j];
+				spectrum[j * 2 + 1] = 0.0f;
+			}
+			magnitudes += bins;
+		}
+		drawSpectrogram(spectra.data(), frames);
+		count -= frames;
+	}
+}
+
+// Continues on another surface of the same height and format, like a new
+// painter but without computing the window and FFT plan again
+void SpectrumPainter::setSurface(SDL_Surface *imageSurface)
+{
+	this->imageSurface = imageSurface;
+	preparePixelWriter();
+	reset();
 }
 
 void SpectrumPainter::reset()
 {
 	blockPosition = 0;
+	blockFill = 0;
 	cursorPosition = 0;
 	samplesProcessed = 0;
 	scrolledTotal = 0;
-	block.assign(settings.fftSize, 0);
+	block.assign(2 * settings.fftSize, 0);
 	SDL_FillRect(imageSurface, NULL, SDL_MapRGB(imageSurface->format, 0, 0, 0));
 }
 
+// Restarts the analysis with an empty block whose first spectrum is drawn
+// at the given column. The image is left untouched.
+void SpectrumPainter::startAtColumn(int column)
+{
+	blockPosition = 0;
+	blockFill = 0;
+	cursorPosition = column;
+}
+
+// Makes column 0 of the image stand for the given column of the whole
+// recording, for images which are one tile of a longer one
+void SpectrumPainter::setFirstColumn(long column)
+{
+	scrolledTotal = column;
+}
+
+// Columns drawn since the last reset
+long SpectrumPainter::getColumnsDrawn() const
+{
+	return scrolledTotal + cursorPosition;
+}
+
+// Oldest column which is still in the image
+long SpectrumPainter::getFirstVisibleColumn() const
+{
+	if(settings.wrapAround)
+		return max(0L, getColumnsDrawn() - imageSurface->w);
+	return scrolledTotal;
+}
 
-void SpectrumPainter::drawSpectrogram(const vector< vector<float> > &spectrums)
+// Position of a visible column in the image
+int SpectrumPainter::getColumnX(long column) const
 {
-	int move = cursorPosition - (imageSurface->w - spectrums.size());
+	int x = int(column - scrolledTotal);
+	return x < 0 ? x + imageSurface->w : x;
+}
+
+void SpectrumPainter::drawSpectrogram(const float *spectra, int count)
+{
+	if(settings.spectrumFile) {
+		long column = getColumnsDrawn();
+		for(int i = 0; i < count; ++i)
+			settings.spectrumFile->writeColumn(column + i, spectra + long(i) * settings.fftSize);
+	}
+
+	if(settings.wrapAround) {
+		while(count > 0) {
+			int run = min(count, imageSurface->w - cursorPosition);
+			drawColumns(spectra, cursorPosition, run);
+			spectra += long(run) * settings.fftSize;
+			count -= run;
+			cursorPosition += run;
+			if(cursorPosition == imageSurface->w) {
+				cursorPosition = 0;
+				scrolledTotal += imageSurface->w;
+			}
+		}
+		return;
+	}
+
+	// Scrolls by moving the rows in place, a blit would need the surface
+	// to be unlocked
+	int move = cursorPosition - (imageSurface->w - count);
 	if(move > 0 && move < imageSurface->w)
 	{
-		SDL_Rect srcrect, dstrect;
-		srcrect.x = move;
-		srcrect.y = 0;
-		srcrect.w = imageSurface->w - move;
-		srcrect.h = imageSurface->h;
-		dstrect.x = 0;
-		dstrect.y = 0;			
-		SDL_BlitSurface(imageSurface, &srcrect, imageSurface, &dstrect);
-		cursorPosition = imageSurface->w - spectrums.size();
+		int bytesPerPixel = imageSurface->format->BytesPerPixel;
+		for(int y = 0; y < imageSurface->h; ++y) {
+			Uint8 *row = static_cast<Uint8*>(imageSurface->pixels) + long(y) * imageSurface->pitch;
+			memmove(row, row + long(move) * bytesPerPixel, long(imageSurface->w - move) * bytesPerPixel);
+			if(settings.indices) {
+				Uint16 *indexRow = settings.indices + long(y) * imageSurface->w;
+				memmove(indexRow, indexRow + move, long(imageSurface->w - move) * sizeof(Uint16));
+			}
+		}
+		cursorPosition = imageSurface->w - count;
 		scrolledTotal += move;
 	}
 
-	SDL_LockSurface(imageSurface);
-	int xlimit = min(int(spectrums.size()), imageSurface->w - cursorPosition);
-	for(int xpos = 0; xpos < xlimit; ++xpos)
-		drawColumn(spectrums[xpos], cursorPosition + xpos);
-	cursorPosition += spectrums.size();
-	SDL_UnlockSurface(imageSurface);
+	int xlimit = min(count, imageSurface->w - cursorPosition);
+	if(xlimit > 0) drawColumns(spectra, cursorPosition, xlimit);
+	cursorPosition += count;
 }
 
-void SpectrumPainter::drawColumn(const vector<float> &spectrum, int xpos)
+// Writes count adjacent columns starting at xpos through the row pointers.
+// Writing column by column would put every store a whole row away from the
+// previous one. Instead the intensities of up to TILE_COLUMNS columns are
+// computed into a column-major tile first, which is then written out row by
+// row, so the stores into the image are sequential. The caller guarantees
+// that the columns are inside the image, so no bounds are checked per pixel.
+void SpectrumPainter::drawColumns(const float *spectra, int xpos, int count)
 {
-	Uint8 *pixels = reinterpret_cast<Uint8*>(imageSurface->pixels);
-	int ylimit = min(int(spectrum.size()), imageSurface->h);
+	int ylimit = min(settings.fftSize / 2, imageSurface->h);
+	int bytesPerPixel = imageSurface->format->BytesPerPixel;
 
-	for(int ypos = 0; ypos < ylimit; ++ypos)
+	for(int first = 0; first < count; first += TILE_COLUMNS)
 	{
-		float amp = hypotf(spectrum[ypos * 2], spectrum[ypos * 2 + 1]); 
-		float value = logarithmicScale(amp * sqrt(ypos) * settings.ampScale);
-		setPixel32(imageSurface, xpos, imageSurface->h - ypos - 1,
-			getColorSDL(imageSurface->format, value));
+		int columns = min(int(TILE_COLUMNS), count - first);
+		for(int i = 0; i < columns; ++i)
+			computeIntensities(spectra + long(first + i) * settings.fftSize, ylimit, &tile[i * ylimit]);
+
+		int offset = (xpos + first) * bytesPerPixel;
+		for(int ypos = 0; ypos < ylimit; ++ypos)
+		{
+			const int *indices = &tile[ypos];
+			if(bytesPerPixel == 4) {
+				Uint32 *p = reinterpret_cast<Uint32*>(rows[ypos] + offset);
+				for(int i = 0; i < columns; ++i)
+					p[i] = palette[indices[i * ylimit]];
+			} else {
+				Uint8 *p = rows[ypos] + offset;
+				for(int i = 0; i < columns; ++i, p += 3) {
+					Uint32 color = palette[indices[i * ylimit]];
+					p[0] = color & 0xff;
+					p[1] = (color >> 8) & 0xff;
+					p[2] = (color >> 16) & 0xff;
+				}
+			}
+			if(settings.indices) {
+				Uint16 *q = settings.indices + long(imageSurface->h - ypos - 1) * imageSurface->w + xpos + first;
+				for(int i = 0; i < columns; ++i)
+					q[i] = indices[i * ylimit];
+			}
+		}
 	}
 }
 
-void SpectrumPainter::frequencyAnalysis(const vector<float> &block, vector<float> &spectrum)
+
+static const float logScaleMin = 1e-2f;
+static const float logScaleMax = 1e-0f;
+
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int v4si __attribute__((vector_size(16)));
+
+// Natural logarithm of positive normal floats. The mantissa is reduced to
+// [sqrt(0.5), sqrt(2)) and log(m) = 2 atanh((m - 1) / (m + 1)) is summed up
+// to t^7, which keeps the absolute error below 1e-7.
+static inline v4sf fastLog(v4sf x)
 {
-	spectrum.resize(block.size());
-	for(int i = 0; i < block.size(); ++i)
-		spectrum[i] = block[i] * window[i];
-	rdft(block.size(), 1, &spectrum[0]);
-	for(int i = 0; i < block.size(); ++i)
-		spectrum[i] *= 2.0 / block.size();
+	v4si bits;
+	memcpy(&bits, &x, sizeof(bits));
+	v4si exponent = ((bits >> 23) & 0xff) - 127;
+	v4si mantissaBits = (bits & 0x7fffff) | 0x3f800000;
+	v4sf m;
+	memcpy(&m, &mantissaBits, sizeof(m));
+
+	v4si large = m > 1.41421356f;
+	m = large ? m * 0.5f : m;
+	exponent -= large;
+
+	v4sf t = (m - 1.0f) / (m + 1.0f);
+	v4sf t2 = t * t;
+	v4sf logm = 2.0f * t * (1.0f + t2 * (1.0f / 3 + t2 * (1.0f / 5 + t2 * (1.0f / 7))));
+	return __builtin_convertvector(exponent, v4sf) * 0.693147181f + logm;
 }
 
-float SpectrumPainter::windowFunc(float x)
+static inline v4sf squareRoot(v4sf x)
 {
-	float tx = (2.0f * x - 1.0f) * settings.tradeoff;
-	float y = expf(-powf(tx, 2.0f) * 0.5f) / sqrt(2.0f * M_PI) * sqrtf(settings.tradeoff) * 4.0f;
-	return y * pow(sin(x * M_PI), 0.5);
+#ifdef __SSE__
+	return __builtin_ia32_sqrtps(x);
+#else
+	for(int i = 0; i < 4; ++i) x[i] = sqrtf(x[i]);
+	return x;
+#endif
 }
 
-float SpectrumPainter::logarithmicScale(float y)
+// Turns the first count bins of a spectrum into palette indices, four bins
+// at a time: magnitude, frequency tilt, logarithmic scale and quantization.
+void SpectrumPainter::computeIntensities(const float *spectrum, int count, int *indices)
 {
-	const float min = 1e-2;
-	const float max = 1e-0f;
-	return (logf(y + min) - logf(min)) / (logf(max) - logf(min));
-}
+	const float logMin = logf(logScaleMin);
+	const float scale = (Colormap::SIZE - 1) / (logf(logScaleMax) - logMin);
+	const v4si evenBins = {0, 2, 4, 6}, oddBins = {1, 3, 5, 7};
 
+	int ypos = 0;
+	for(; ypos + 4 <= count; ypos += 4)
+	{
+		v4sf a, b, w;
+		memcpy(&a, spectrum + ypos * 2, sizeof(a));
+		memcpy(&b, spectrum + ypos * 2 + 4, sizeof(b));
+		memcpy(&w, &tilt[ypos], sizeof(w));
+		v4sf re = __builtin_shuffle(a, b, evenBins);
+		v4sf im = __builtin_shuffle(a, b, oddBins);
+
+		// Same as SpectrumFile::magnitude, sqrtps rounds like sqrtf
+		v4sf amp = squareRoot(re * re + im * im) * w;
+		v4sf value = (fastLog(amp + logScaleMin) - logMin) * scale + 0.5f;
+		// NaN from non-finite input fails the comparison and maps to 0
+		value = value >= 0.0f ? value : 0.0f;
+		value = value > float(Colormap::SIZE - 1) ? float(Colormap::SIZE - 1) : value;
+		v4si index = __builtin_convertvector(value, v4si);
+		memcpy(indices + ypos, &index, sizeof(index));
+	}
 
+	for(; ypos < count; ++ypos)
+	{
+		float amp = SpectrumFile::magnitude(spectrum[ypos * 2], spectrum[ypos * 2 + 1]);
+		float value = logarithmicScale(amp * tilt[ypos]) * (Colormap::SIZE - 1) + 0.5f;
+		value = value >= 0.0f ? value : 0.0f;
+		value = value > float(Colormap::SIZE - 1) ? float(Colormap::SIZE - 1) : value;
+		indices[ypos] = int(value);
+	}
+}
 
+// Transforms a batch of windowed frames in place
+void SpectrumPainter::frequencyAnalysis(float *frames, int count)
+{
+	int size = settings.fftSize;
+	fftPlan->rdftBatch(frames, count);
+	for(long i = 0; i < long(count) * size; ++i)
+		frames[i] *= 2.0 / size;
+}
 
-void SpectrumPainter::getColor(float x, float &r, float &g, float &b)
+float SpectrumPainter::windowFunc(float x, float tradeoff)
 {
-	const int csamples = 6;
-	float colors[csamples][3] = {
-		{0.0, 0.0, 0.0},
-		{0.0, 0.0, 0.75},
-		{0.0, 0.75, 0.0},
-		{0.8, 0.8, 0.0},
-		{0.9, 0.2, 0.2},
-		{1.0, 1.0, 1.0}};
+	float tx = (2.0f * x - 1.0f) * tradeoff;
+	float y = expf(-powf(tx, 2.0f) * 0.5f) / sqrt(2.0f * M_PI) * sqrtf(tradeoff) * 4.0f;
+	return y * pow(sin(x * M_PI), 0.5);
+}
 
-	x *= csamples - 1;
-	int xi = int(x);
-	float xf = x - xi;
-	if(xi < 0) {xi = 0; xf = 0;}
-	if(xi >= csamples - 1) {xi = csamples - 2; xf = 1.0;}
-	
-	r = colors[xi][0] * (1.0 - xf) + colors[xi + 1][0] * xf;
-	g = colors[xi][1] * (1.0 - xf) + colors[xi + 1][1] * xf;
-	b = colors[xi][2] * (1.0 - xf) + colors[xi + 1][2] * xf;
+// Painters with the same FFT size and tradeoff share one window table,
+// it is computed when the first of them is created
+shared_ptr<const vector<float> > SpectrumPainter::sharedWindow(int size, float tradeoff)
+{
+	static mutex windowsMutex;
+	static map<pair<int, float>, shared_ptr<const vector<float> > > windows;
+
+	lock_guard<mutex> lock(windowsMutex);
+	shared_ptr<const vector<float> > &window = windows[make_pair(size, tradeoff)];
+	if(!window) {
+		vector<float> *table = new vector<float>(size);
+		for(long i = 0; i < size; ++i)
+			(*table)[i] = windowFunc(float(i) / size, tradeoff);
+		window.reset(table);
+	}
+	return window;
 }
 
-Uint32 SpectrumPainter::getColorSDL(SDL_PixelFormat *format, float x)
+float SpectrumPainter::logarithmicScale(float y)
 {
-	float r, g, b;
-	getColor(x, r, g, b);
-	if(r < 0.0f) r = 0.0f;
-	if(r > 1.0f) r = 1.0f;
-	if(g < 0.0f) g = 0.0f;
-	if(g > 1.0f) g = 1.0f;
-	if(b < 0.0f) b = 0.0f;
-	if(b > 1.0f) b = 1.0f;
-	return SDL_MapRGB(format, int(r * 255), int(g * 255), int(b * 255));
+	return (logf(y + logScaleMin) - logf(logScaleMin)) / (logf(logScaleMax) - logf(logScaleMin));
 }
 
-void SpectrumPainter::setPixel32(SDL_Surface *surface, int x, int y, Uint32 color)
+
+
+
+// Bakes the color map into pixel values of the image format and caches
+// the row addresses, lowest frequency (bottom row) first.
+void SpectrumPainter::preparePixelWriter()
 {
-	if(x < 0 || x >= surface->w || y < 0 || y >= surface->h) {printf("Overflow: %d %d\n", x, y); exit(1);}
-	Uint8* p = reinterpret_cast<Uint8*>(surface->pixels) + y * surface->pitch + x * surface->format->BytesPerPixel;
-	p[0] = color & 0xff;
-	p[1] = (color >> 8) & 0xff;
-	p[2] = (color >> 16) & 0xff;
+	settings.colormap->bake(imageSurface->format, palette);
+
+	// Higher frequencies are amplified by sqrt(f), combined with ampScale
+	tilt.resize(imageSurface->h);
+	for(int ypos = 0; ypos < imageSurface->h; ++ypos)
+		tilt[ypos] = sqrtf(ypos) * settings.ampScale;
+	tile.resize(TILE_COLUMNS * imageSurface->h);
+
+	rows.resize(imageSurface->h);
+	Uint8 *pixels = reinterpret_cast<Uint8*>(imageSurface->pixels);
+	for(int ypos = 0; ypos < imageSurface->h; ++ypos)
+		rows[ypos] = pixels + long(imageSurface->h - ypos - 1) * imageSurface->pitch;
 }
 
 
 
 
-SDL_Surface* SpectrumPainter::audioToImage(const vector<Sint16> &audioData, const Settings &settings)
+long SpectrumPainter::getImageWidth(long frames, const Settings &settings)
+{
+	return max(1L, (frames - settings.fftSize) / settings.windowInc + 1);
+}
+
+int SpectrumPainter::getImageHeight(const Settings &settings)
 {
-	int frames = audioData.size() / settings.channels;
-	int imageWidth = (frames - settings.fftSize) / settings.windowInc + 1;
 	int imageHeight = int(settings.upperFreqLimit / settings.freqResolution) + 1;
-	if(imageHeight > settings.fftSize / 2) imageHeight = settings.fftSize / 2;
-	if(imageWidth <= 0) imageWidth = 1;
+	return min(imageHeight, settings.fftSize / 2);
+}
 
+SDL_Surface* SpectrumPainter::createImage(long frames, const Settings &settings)
+{
+	long imageWidth = getImageWidth(frames, settings);
+	int imageHeight = getImageHeight(settings);
 	
 	cout << "Frames: " << frames << endl;
 	cout << "Length: " << float(frames) / settings.sampleRate << " sec" << endl;
 	cout << "Frequency resolution: " << settings.freqResolution << " Hz" << endl;
 	cout << "Time resolution: " << settings.timeResolution << " sec" << endl;
 
+	if(!fitsSurface(imageWidth, imageHeight, settings))
+		throw Error("Image is too large for a single surface, use tiles");
 
 	cout << "Compute image of size " << imageWidth << "x" << imageHeight << ":" << endl;
-	SDL_Surface *image = SDL_CreateRGBSurface(0, imageWidth, imageHeight, 24, 0x000000ff, 0x0000ff00, 0x00ff0000, 0);
+	return createSurface(int(imageWidth), imageHeight, settings);
+}
+
+// SDL computes pixel offsets as int, so all pixels of a surface have to
+// be addressable by an int, not only a single row. Rows are padded to 4 bytes.
+bool SpectrumPainter::fitsSurface(long width, int height, const Settings &settings)
+{
+	long pitch = (width * (settings.bitsPerPixel / 8) + 3) / 4 * 4;
+	return pitch * height <= INT_MAX;
+}
+
+SDL_Surface* SpectrumPainter::createSurface(int width, int height, const Settings &settings)
+{
+	SDL_Surface *image;
+	if(settings.bitsPerPixel == 32)
+		image = SDL_CreateRGBSurface(0, width, height, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+	else
+		image = SDL_CreateRGBSurface(0, width, height, 24, 0x000000ff, 0x0000ff00, 0x00ff0000, 0);
 	Error::raiseIfNull(image, "SDL_CreateRGBSurface failed");
+	return image;
+}
 
-	SDL_LockSurface(image);
+// Writes base.json, which describes an image saved as tiles of tileWidth columns
+void SpectrumPainter::writeTileManifest(const string &base, const vector<string> &tileNames, long imageWidth,
+	int imageHeight, int tileWidth, const Settings &settings)
+{
+	ofstream manifest((base + ".json").c_str());
+	manifest << "{" << endl;
+	manifest << "\t\"width\": " << imageWidth << "," << endl;
+	manifest << "\t\"height\": " << imageHeight << "," << endl;
+	manifest << "\t\"tileWidth\": " << tileWidth << "," << endl;
+	manifest << "\t\"sampleRate\": " << settings.sampleRate << "," << endl;
+	manifest << "\t\"fftSize\": " << settings.fftSize << "," << endl;
+	manifest << "\t\"windowInc\": " << settings.windowInc << "," << endl;
+	manifest << "\t\"timeResolution\": " << settings.timeResolution << "," << endl;
+	manifest << "\t\"freqResolution\": " << settings.freqResolution << "," << endl;
+	manifest << "\t\"tiles\": [";
+	for(long i = 0; i < tileNames.size(); ++i) {
+		// Names relative to the manifest
+		string name = tileNames[i].substr(tileNames[i].find_last_of('/') + 1);
+		manifest << (i > 0 ? ", " : "") << "\"" << name << "\"";
+	}
+	manifest << "]" << endl;
+	manifest << "}" << endl;
+	Error::raiseIfNull(manifest.good(), "Could not write the tile manifest");
+}
 
-	SpectrumPainter spectrumPainter(image, settings);
-	vector<float> input;
-	
+void SpectrumPainter::mixToMono(const Sint16 *audioData, int frames, int channels, vector<float> &output)
+{
+	output.resize(frames);
 	for(int i = 0; i < frames; ++i)
-	{	
+	{
 		float monoSample = 0.0;
-		for(int j = 0; j < settings.channels; ++j)
-			monoSample += audioData[i * settings.channels + j];
-		monoSample /= 32768.0f * settings.channels;
-		input.push_back(monoSample);
-	
-		if(i % settings.sampleRate == 0)
-		{
-			cout << i / settings.sampleRate << " ";
-			cout.flush();
-			spectrumPainter.feedWithInput(input);
-			input.clear();
-		}
+		for(int j = 0; j < channels; ++j)
+			monoSample += audioData[i * channels + j];
+		monoSample /= 32768.0f * channels;
+		output[i] = monoSample;
 	}
-	
-	spectrumPainter.feedWithInput(input);
-	cout << "Complete!" << endl;
-
-	SDL_UnlockSurface(image);
-	if(settings.labels) spectrumPainter.drawLabeling(image);
-	
-	return image;
 }
 
-
-
-void SpectrumPainter::drawLabeling(SDL_Surface *surface)
+// Frequency and time grid labels for an image of the given size
+void SpectrumPainter::getLabels(int width, int height, vector<Label> &labels)
 {
 	const float frequencyGrid = 1000.0;
 	const float timeGrid = 1.0;
 
-	float timeStart = scrolledTotal * settings.timeResolution;
-	float timeEnd = (scrolledTotal  + surface->w) * settings.timeResolution;
+	long firstColumn = getFirstVisibleColumn();
+	float timeStart = firstColumn * settings.timeResolution;
+	float timeEnd = (firstColumn  + width) * settings.timeResolution;
 	
 	int frequencySteps = ceil(settings.upperFreqLimit / frequencyGrid);	
 	int timeStepsStart = floor(timeStart / timeGrid) - 1;
 	int timeStepsEnd = ceil(timeEnd / timeGrid);
-	SDL_Color textColor = { 255, 255, 255, 255 };
+	int fontHeight = TTF_FontHeight(settings.font);
 
+	labels.clear();
 	for(int i = 1; i < frequencySteps; ++i) {
-		string text = toString(i * frequencyGrid / 1000.0) + "kHz";
-
-		SDL_Surface* textSurface = TTF_RenderText_Blended(settings.font, text.c_str(), textColor);
-		Error::raiseIfNull(textSurface, "TTF_RenderText_Solid failed");
-		
-		SDL_Rect dstrect;
-		dstrect.x = 0;
-		dstrect.y = surface->h - i * frequencyGrid / settings.freqResolution - TTF_FontHeight(settings.font) / 2;
-		SDL_BlitSurface(textSurface, NULL, surface, &dstrect);
-		SDL_FreeSurface(textSurface);
+		Label label;
+		label.text = toString(i * frequencyGrid / 1000.0) + "kHz";
+		label.x = 0;
+		label.y = height - i * frequencyGrid / settings.freqResolution - fontHeight / 2;
+		labels.push_back(label);
 	}
 
 	for(int i = timeStepsStart; i <= timeStepsEnd; ++i) {
-		string text = toString(i * timeGrid) + "s";
-		
-		SDL_Surface* textSurface = TTF_RenderText_Blended(settings.font, text.c_str(), textColor);
-		Error::raiseIfNull(textSurface, "TTF_RenderText_Solid failed");
-		
-		SDL_Rect dstrect;		
-		dstrect.x = i * timeGrid / settings.timeResolution - scrolledTotal;
-		dstrect.y = surface->h - TTF_FontHeight(settings.font);				
-		SDL_BlitSurface(textSurface, NULL, surface, &dstrect);
-		SDL_FreeSurface(textSurface);
+		Label label;
+		label.text = toString(i * timeGrid) + "s";
+		label.x = i * timeGrid / settings.timeResolution - firstColumn;
+		label.y = height - fontHeight;
+		labels.push_back(label);
+	}
+}
+
+void SpectrumPainter::drawLabeling(SDL_Surface *surface)
+{
+	vector<Label> labels;
+	getLabels(surface->w, surface->h, labels);
+
+	for(int i = 0; i < labels.size(); ++i) {
+		SDL_Rect dstrect;
+		dstrect.x = labels[i].x;
+		dstrect.y = labels[i].y;
+		SDL_BlitSurface(labelCache.getSurface(settings.font, labels[i].text), NULL, surface, &dstrect);
 	}
 }
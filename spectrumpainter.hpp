@@ -7,6 +7,10 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include "fftplan.hpp"
+#include "colormap.hpp"
+#include "labelcache.hpp"
+#include "spectrumfile.hpp"
 
 using namespace std;
 
@@ -21,7 +25,15 @@ struct Settings
 		upperFreqLimit = 7000.0;
 		ampScale = 1.0;
 		labels = true;
+		wrapAround = false;
+		bitsPerPixel = 32;
+		spectrumFile = NULL;
+		indices = NULL;
 		font = NULL;
+		threads = 1;
+		batchFrames = 64;
+		fftKernel = NULL;
+		colormap = Colormap::getDefault();
 		computeHelper();
 	}
 
@@ -38,35 +50,86 @@ struct Settings
 	float timeResolution, freqResolution;
 	float ampScale;
 	bool labels;
+	// Draw at a moving write head instead of scrolling the image, the oldest
+	// column is at getColumnX(getFirstVisibleColumn())
+	bool wrapAround;
+	// Images made by createImage, 32 (XRGB, one aligned store per pixel) or
+	// 24. bpptest measures the difference.
+	int bitsPerPixel;
+	// Receives the magnitudes of every column drawn, if set
+	SpectrumFile *spectrumFile;
+	// Receives the palette index of every pixel drawn, if set. One value
+	// per pixel in rows as wide as the image, top row first.
+	Uint16 *indices;
 	TTF_Font *font;
+	int threads, batchFrames;
+	const FFTKernel *fftKernel;
+	const Colormap *colormap;
 };
 
 
+// Text of a label and the position of its upper left corner
+struct Label
+{
+	string text;
+	int x, y;
+};
+
+
+// Draws the spectra of the input into imageSurface. The painter writes the
+// pixels directly and never locks the surface, the owner of the surface
+// keeps it locked while feeding if SDL_MUSTLOCK requires it. Several
+// painters may draw disjoint columns of the same surface at once.
 class SpectrumPainter
 {
 public:
 	SpectrumPainter(SDL_Surface *imageSurface, const Settings &settings);
 	void feedWithInput(const vector<float> &input);
+	void feedWithInput(const float *input, int count);
+	void feedWithMagnitudes(const float *magnitudes, int count);
+	void setSurface(SDL_Surface *imageSurface);
 	void reset();
-	static SDL_Surface* audioToImage(const vector<Sint16> &audioData, const Settings &settings);
+	void startAtColumn(int column);
+	void setFirstColumn(long column);
+	long getColumnsDrawn() const;
+	long getFirstVisibleColumn() const;
+	int getColumnX(long column) const;
+	static SDL_Surface* createImage(long frames, const Settings &settings);
+	static SDL_Surface* createSurface(int width, int height, const Settings &settings);
+	static bool fitsSurface(long width, int height, const Settings &settings);
+	static long getImageWidth(long frames, const Settings &settings);
+	static int getImageHeight(const Settings &settings);
+	static void writeTileManifest(const string &base, const vector<string> &tileNames, long imageWidth,
+		int imageHeight, int tileWidth, const Settings &settings);
+	static void mixToMono(const Sint16 *audioData, int frames, int channels, vector<float> &output);
+	void getLabels(int width, int height, vector<Label> &labels);
 	void drawLabeling(SDL_Surface *surface);	
 private:
-	void frequencyAnalysis(const vector<float> &block, vector<float> &spectrum);
-	void drawSpectrogram(const vector< vector<float> > &spectrums);
-	void drawColumn(const vector<float> &spectrum, int xpos);
-	float windowFunc(float x);
+	void frequencyAnalysis(float *frames, int count);
+	void drawSpectrogram(const float *spectra, int count);
+	void drawColumns(const float *spectra, int xpos, int count);
+	void computeIntensities(const float *spectrum, int count, int *indices);
+	static float windowFunc(float x, float tradeoff);
+	static shared_ptr<const vector<float> > sharedWindow(int size, float tradeoff);
 	float logarithmicScale(float y);
 
-	void getColor(float x, float &r, float &g, float &b);
-	Uint32 getColorSDL(SDL_PixelFormat *format, float x);
-	void setPixel32(SDL_Surface *surface, int x, int y, Uint32 color);
+	void preparePixelWriter();
 
-	vector<float> block, window;
-	vector< vector<float> > spectrums;
-	int blockPosition, cursorPosition, samplesProcessed, scrolledTotal;
+	vector<float> block;
+	shared_ptr<const vector<float> > window;
+	vector<Uint32> palette;
+	vector<Uint8*> rows;
+	vector<float> tilt;
+	enum {TILE_COLUMNS = 64};
+	vector<int> tile;
+	vector<float> spectra;
+	shared_ptr<const FFTPlan> fftPlan;
+	int blockPosition, blockFill, cursorPosition;
+	long samplesProcessed, scrolledTotal;
 
 	Settings settings;
 	SDL_Surface *imageSurface;
+	LabelCache labelCache;
 };
 
 
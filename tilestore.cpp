@@ -0,0 +1,160 @@
+#include "tilestore.hpp"
+#include "spectrumpainter.hpp"
+#include <algorithm>
+#include <unistd.h>
+
+TileStore::TileStore(const SDL_Surface *view, int tileWidth)
+{
+	this->tileWidth = tileWidth;
+
+	const SDL_PixelFormat *format = view->format;
+	tile = SDL_CreateRGBSurface(0, tileWidth, view->h, format->BitsPerPixel,
+		format->Rmask, format->Gmask, format->Bmask, format->Amask);
+	Error::raiseIfNull(tile, "SDL_CreateRGBSurface failed");
+
+	file = NULL;
+	clear();
+}
+
+TileStore::~TileStore()
+{
+	fclose(file);
+	SDL_FreeSurface(tile);
+}
+
+void TileStore::clear()
+{
+	// A file of its own for every store, which is deleted when it is closed,
+	// even if the program crashes
+	if(file) fclose(file);
+	file = tmpfile();
+	Error::raiseIfNull(file, "Could not create the spectrum tile file");
+
+	columns = 0;
+	SDL_FillRect(tile, NULL, SDL_MapRGB(tile->format, 0, 0, 0));
+}
+
+long TileStore::getColumns() const
+{
+	return columns;
+}
+
+int TileStore::getHeight() const
+{
+	return tile->h;
+}
+
+// Copies the columns drawn since the last update out of the live view.
+// Columns which have already been scrolled out of the view stay black.
+void TileStore::update(SDL_Surface *view, const SpectrumPainter &painter)
+{
+	long columnsDrawn = painter.getColumnsDrawn();
+	long oldest = painter.getFirstVisibleColumn();
+	if(columns < oldest) {
+		while(columns / tileWidth < oldest / tileWidth) {
+			columns = (columns / tileWidth + 1) * tileWidth;
+			flushTile();
+		}
+		columns = oldest;
+	}
+
+	while(columns < columnsDrawn)
+	{
+		// Runs end at the tile border and where the view wraps around
+		int x = int(columns % tileWidth);
+		int viewX = painter.getColumnX(columns);
+		int count = int(min(columnsDrawn - columns, long(min(tileWidth - x, view->w - viewX))));
+
+		SDL_Rect srcrect, dstrect;
+		srcrect.x = viewX;
+		srcrect.y = 0;
+		srcrect.w = count;
+		srcrect.h = view->h;
+		dstrect.x = x;
+		dstrect.y = 0;
+		SDL_BlitSurface(view, &srcrect, tile, &dstrect);
+
+		columns += count;
+		if(columns % tileWidth == 0) flushTile();
+	}
+}
+
+// Appends the completed tile to the file row by row and starts a new one
+void TileStore::flushTile()
+{
+	int rowBytes = tileWidth * tile->format->BytesPerPixel;
+	SDL_LockSurface(tile);
+	for(int y = 0; y < tile->h; ++y)
+		fwrite(static_cast<Uint8*>(tile->pixels) + long(y) * tile->pitch, 1, rowBytes, file);
+	SDL_UnlockSurface(tile);
+	fflush(file);
+
+	SDL_FillRect(tile, NULL, SDL_MapRGB(tile->format, 0, 0, 0));
+}
+
+TileStore::Snapshot TileStore::takeSnapshot()
+{
+	Snapshot snapshot;
+	snapshot.columns = columns;
+	snapshot.lastTile = SDL_ConvertSurface(tile, tile->format, 0);
+	Error::raiseIfNull(snapshot.lastTile, "SDL_ConvertSurface failed");
+	return snapshot;
+}
+
+void TileStore::freeSnapshot(Snapshot &snapshot)
+{
+	SDL_FreeSurface(snapshot.lastTile);
+	snapshot.lastTile = NULL;
+}
+
+// Same pixel format as the tiles
+SDL_Surface* TileStore::createSurface(int width) const
+{
+	const SDL_PixelFormat *format = tile->format;
+	SDL_Surface *image = SDL_CreateRGBSurface(0, width, tile->h,
+		format->BitsPerPixel, format->Rmask, format->Gmask, format->Bmask, format->Amask);
+	Error::raiseIfNull(image, "SDL_CreateRGBSurface failed");
+	return image;
+}
+
+// Fills image with the columns from firstColumn on, from the tiles in the
+// file and the last tile of the snapshot. Columns past the snapshot stay
+// as they are. Only reads tiles which were complete when the snapshot was
+// taken, with pread, so it may run on another thread while the store is
+// updated.
+void TileStore::drawColumns(const Snapshot &snapshot, long firstColumn, SDL_Surface *image) const
+{
+	int bytesPerPixel = image->format->BytesPerPixel;
+	long rowBytes = long(tileWidth) * bytesPerPixel;
+	long completeTiles = snapshot.columns / tileWidth;
+	long lastColumn = min(firstColumn + image->w, snapshot.columns);
+
+	int input = fileno(file);
+	vector<Uint8> row(rowBytes);
+
+	SDL_LockSurface(image);
+	for(long i = firstColumn / tileWidth; i < completeTiles && i * tileWidth < lastColumn; ++i)
+	{
+		// Part of the tile inside the image
+		long begin = max(firstColumn, i * tileWidth), end = min(lastColumn, (i + 1) * tileWidth);
+		long offset = (begin - i * tileWidth) * bytesPerPixel, bytes = (end - begin) * bytesPerPixel;
+		for(int y = 0; y < image->h; ++y) {
+			ssize_t read = pread(input, &row[0], row.size(), (i * tile->h + y) * rowBytes);
+			Uint8 *p = static_cast<Uint8*>(image->pixels) + long(y) * image->pitch;
+			if(read == ssize_t(row.size()))
+				copy(&row[offset], &row[offset + bytes], p + (begin - firstColumn) * bytesPerPixel);
+		}
+	}
+	SDL_UnlockSurface(image);
+
+	long lastTileStart = max(firstColumn, completeTiles * tileWidth);
+	SDL_Rect srcrect, dstrect;
+	srcrect.x = int(lastTileStart - completeTiles * tileWidth);
+	srcrect.y = 0;
+	srcrect.w = int(lastColumn - lastTileStart);
+	srcrect.h = image->h;
+	dstrect.x = int(lastTileStart - firstColumn);
+	dstrect.y = 0;
+	if(srcrect.w > 0)
+		SDL_BlitSurface(snapshot.lastTile, &srcrect, image, &dstrect);
+}
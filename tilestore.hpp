@@ -0,0 +1,48 @@
+#ifndef TILESTORE_HPP
+#define TILESTORE_HPP
+
+#include <SDL_surface.h>
+#include <cstdio>
+
+class SpectrumPainter;
+
+using namespace std;
+
+// Full-length spectrogram of a recording, collected from the scrolling live
+// view as new columns appear. Columns are gathered in a tile of fixed width;
+// completed tiles are appended to a temporary file, so only one tile stays
+// in memory. Any range of columns can be put together at any time from a
+// snapshot.
+class TileStore
+{
+public:
+	// Taken on the thread which updates the store, can be drawn on any thread
+	struct Snapshot
+	{
+		long columns;
+		SDL_Surface *lastTile;
+	};
+
+	TileStore(const SDL_Surface *view, int tileWidth = 1024);
+	~TileStore();
+
+	void update(SDL_Surface *view, const SpectrumPainter &painter);
+	void clear();
+	long getColumns() const;
+	int getHeight() const;
+
+	Snapshot takeSnapshot();
+	SDL_Surface* createSurface(int width) const;
+	void drawColumns(const Snapshot &snapshot, long firstColumn, SDL_Surface *image) const;
+	static void freeSnapshot(Snapshot &snapshot);
+
+private:
+	void flushTile();
+
+	FILE *file;
+	SDL_Surface *tile;
+	int tileWidth;
+	long columns;
+};
+
+#endif